@@ -13,33 +13,53 @@
  */
 #include <linux/videodev2.h>
 #include <media/v4l2-device.h>
+#include <media/v4l2-event.h>
 
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/gcd.h>
+#include <linux/gpio/consumer.h>
 #include <linux/i2c.h>
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include <linux/regulator/consumer.h>
+#include <linux/workqueue.h>
+#include <media/mipi-csi2.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-fwnode.h>
 #include <media/v4l2-subdev.h>
+
+#include "uapi/ar1335.h"
+
 #define AR1335_NAME "ar1335"
 #define AR1335_MAX_RATIO_MISMATCH 10
 #define EXPOSURE_MAX 0xC4E
-#define FRAME_LENGTH_LINE_MAX 0x0C4E
 #define LINE_LENGTH_PCK_MAX 4656
 /* External clock (extclk) frequencies */
 #define AR1335_EXTCLK_MIN		(6 * 1000 * 1000)
 #define AR1335_EXTCLK_MAX		(48 * 1000 * 1000)
+/* Power up timing, overridable from DT */
+#define AR1335_POWER_ON_DELAY_US	1000	/* supplies stable, reset held */
+#define AR1335_RESET_DELAY_US		1000	/* reset released to first I2C */
+#define AR1335_EXTCLK_SETTLE_US		100	/* extclk restart to first I2C */
+/* Candidate extclk rates read from DT */
+#define AR1335_EXTCLK_RATES_MAX		8
 /* PLL and PLL2 */
 #define AR1335_PLL_MIN			(320 * 1000 * 1000)
 #define AR1335_PLL_MAX			(1200 * 1000 * 1000)
 #define MAX_FRAME_RATE 60
 #define MIN_FRAME_RATE 30
 #define AR1335_DEF_FRAME_RATE 30
+/* Lowest rate auto frame rate may drop to */
+#define AR1335_AFR_MIN_FRAME_RATE	1
+#define AR1335_AFR_DEF_FRAME_RATE	10
 #define REG_FRAME_RATE 0x0340
 
 /* Effective pixel sample rate on the pixel array. */
 #define AR1335_PIXEL_CLOCK_RATE		(220 * 1000 * 1000)
-#define AR1335_PIXEL_CLOCK_MIN		(168 * 1000 * 1000)
-#define AR1335_PIXEL_CLOCK_MAX		(414 * 1000 * 1000)
+/* The array is read out two pixels per pixel clock */
+#define AR1335_PIXELS_PER_CLOCK		2
 
 #define AR1335_MIN_X_ADDR_START		8u
 #define AR1335_MIN_Y_ADDR_START		8u
@@ -53,6 +73,29 @@
 
 #define AR1335_WIDTH_BLANKING_MIN	240u
 #define AR1335_HEIGHT_BLANKING_MIN	142u /* must be even */
+#define AR1335_EXPOSURE_MARGIN		4u   /* frame_length - max exposure */
+
+/*
+ * Power model, rough figures from typical datasheet consumption: supplies
+ * on with extclk gated, clocked but idle, plus the PLL, the array readout
+ * per pixel read and the MIPI transmitter per lane and per bit sent.
+ */
+#define AR1335_POWER_STANDBY_UW		1000
+#define AR1335_POWER_IDLE_UW		25000
+#define AR1335_POWER_PLL_UW_PER_MHZ	20
+#define AR1335_POWER_PIXEL_PJ		380
+#define AR1335_POWER_LANE_UW		2000
+#define AR1335_POWER_BIT_PJ		15
+#define AR1335_POWER_MAX_UW		(2 * 1000 * 1000)
+
+/* Thermal throttling, each level halves the frame rate */
+#define AR1335_THERMAL_POLL_MS		1000
+#define AR1335_THERMAL_LEVEL_MAX	3
+#define AR1335_THERMAL_TEMP_MIN		40
+#define AR1335_THERMAL_TEMP_MAX		125
+#define AR1335_THERMAL_TEMP_DEF		85
+#define AR1335_THERMAL_HYST_MAX		30
+#define AR1335_THERMAL_HYST_DEF		10
 #define AR1335_TOTAL_HEIGHT_MAX		65535u /* max_frame_length_lines */
 #define AR1335_TOTAL_WIDTH_MAX		65532u /* max_line_length_pck */
 
@@ -62,8 +105,10 @@
 #define AR1335_ANA_GAIN_DEFAULT		0x00
 
 /* AR1335 registers */
+#define AR1335_REG_DATA_FORMAT			0x0112 /* input << 8 | output bpp */
 #define AR1335_REG_VT_PIX_CLK_DIV		0x0300
 #define AR1335_REG_FRAME_LENGTH_LINES		0x0340
+#define AR1335_REG_X_EVEN_INC			0x0380
 
 #define AR1335_REG_CHIP_ID			0x0000
 #define AR1335_REG_COARSE_INTEGRATION_TIME	0x3012
@@ -76,6 +121,11 @@
 #define   AR1335_REG_RESET_RESTART		  BIT(1)
 #define   AR1335_REG_RESET_INIT			  BIT(0)
 
+#define AR1335_REG_DATA_PEDESTAL		0x301E
+#define   AR1335_DATA_PEDESTAL_MAX		  0x0fff
+
+#define AR1335_REG_FRAME_COUNT			0x303A
+
 #define AR1335_REG_ANA_GAIN_CODE_GLOBAL		0x3028
 
 #define AR1335_REG_GREEN1_GAIN			0x3056
@@ -84,10 +134,31 @@
 #define AR1335_REG_GREEN2_GAIN			0x305C
 #define AR1335_REG_GLOBAL_GAIN			0x305E
 
+#define AR1335_REG_SMIA_TEST			0x3064
+#define   AR1335_REG_SMIA_TEST_EMBEDDED_DATA	  BIT(8)
+
 #define AR1335_REG_HISPI_TEST_MODE		0x3066
 #define AR1335_REG_HISPI_TEST_MODE_LP11		  0x0004
 
 #define AR1335_REG_TEST_PATTERN_MODE		0x3070
+#define AR1335_REG_TEST_DATA_RED		0x3072
+#define AR1335_REG_TEST_DATA_GREENR		0x3074
+#define AR1335_REG_TEST_DATA_BLUE		0x3076
+#define AR1335_REG_TEST_DATA_GREENB		0x3078
+#define   AR1335_TEST_DATA_MAX			  0x03ff
+
+#define AR1335_REG_TEMPSENS_DATA		0x30B2
+#define AR1335_REG_TEMPSENS_CTRL		0x30B4
+#define   AR1335_REG_TEMPSENS_CTRL_ENABLE	  BIT(0)
+#define   AR1335_REG_TEMPSENS_CTRL_START	  BIT(4)
+/* Factory readings at the two calibration temperatures */
+#define AR1335_REG_TEMPSENS_CALIB1		0x30C6
+#define AR1335_REG_TEMPSENS_CALIB2		0x30C8
+#define   AR1335_TEMPSENS_CALIB1_TEMP		  55
+#define   AR1335_TEMPSENS_CALIB2_TEMP		  70
+
+#define AR1335_REG_COLUMN_CORRECTION		0x30D4
+#define   AR1335_REG_COLUMN_CORRECTION_ENABLE	  BIT(15)
 
 #define AR1335_REG_SERIAL_FORMAT		0x31AE
 #define AR1335_REG_SERIAL_FORMAT_MIPI		  0x0200
@@ -95,6 +166,18 @@
 #define AR1335_REG_HISPI_CONTROL_STATUS		0x31C6
 #define AR1335_REG_HISPI_CONTROL_STATUS_FRAMER_TEST_MODE_ENABLE 0x80
 
+#define AR1335_REG_PIX_DEF_ID			0x31E0
+#define   AR1335_REG_PIX_DEF_ID_ENABLE		  BIT(0)
+
+#define AR1335_REG_MIPI_CNTRL			0x3354
+#define   AR1335_REG_MIPI_CNTRL_VC_MASK		  GENMASK(7, 6)
+#define   AR1335_REG_MIPI_CNTRL_VC_SHIFT	  6
+
+#define AR1335_SNAPSHOT_FRAMES_MAX		255
+
+#define AR1335_EVENT_QUEUE_LEN			4
+#define AR1335_VIRTUAL_CHANNEL_MAX		3
+
 #define be		cpu_to_be16
 
 static const char * const ar1335_supply_names[] = {
@@ -102,6 +185,22 @@ static const char * const ar1335_supply_names[] = {
 	"vdd",		/* Core, PLL and MIPI (1.2V) supply */
 	"vaa",		/* Analog (2.7V) supply */
 };
+
+/* Address ranges write-verify mismatches are counted by, first match wins */
+static const struct ar1335_reg_range {
+	u16 start;
+	u16 end;
+	const char *name;
+} ar1335_verify_ranges[] = {
+	{ 0x0000, 0x0fff, "smia" },	/* PLL, geometry, frame timing */
+	{ 0x3000, 0x30ff, "sensor" },	/* integration, gains, test */
+	{ 0x3100, 0x31ff, "serial" },	/* data format, HiSPi, defects */
+	{ 0x0000, 0xffff, "other" },
+};
+
+/* Read back every burst written, enabled per device through debugfs */
+static DEFINE_STATIC_KEY_FALSE(ar1335_write_verify);
+
 struct ar1335_reg {
 	u16 addr;
 	u16 val;
@@ -112,7 +211,16 @@ struct ar1335_res_struct {
 	u16 height;
 	u16 out_fmt;
 	u16 fps;
+	/* Read one pixel pair out of every skip pairs in both directions */
+	u8 skip;
+	/* Only selected when asked for by its exact size, never best fit */
+	bool exact;
+	/* Run the PLL at its minimum, readout slows down to match */
+	bool low_pll;
 	struct ar1335_reg *ar1335_mode;
+	/* On-sensor pixel processing defaults for this mode */
+	bool defect_correction;
+	bool noise_correction;
 };
 
 struct ar1335_context_res {
@@ -120,8 +228,10 @@ struct ar1335_context_res {
 	s32 cur_res;
 	struct ar1335_res_struct *res_table;
 };
-static const s64 ar1335_link_frequencies[] = {
-	184000000,
+/* Media bus codes, the first one is the default */
+static const u32 ar1335_mbus_codes[] = {
+	MEDIA_BUS_FMT_SRGGB10_1X10,
+	MEDIA_BUS_FMT_SRGGB8_1X8,
 };
 
 struct ar1335_ctrls {
@@ -136,8 +246,57 @@ struct ar1335_ctrls {
 		struct v4l2_ctrl *vblank;
 	};
 	struct v4l2_ctrl *pixrate;
+	struct v4l2_ctrl *link_freq;
 	struct v4l2_ctrl *exposure;
+	struct v4l2_ctrl *power_line_freq;
+	struct v4l2_ctrl *auto_frame_rate;
+	struct v4l2_ctrl *min_frame_rate;
+	struct v4l2_ctrl *snapshot_frames;
+	struct v4l2_ctrl *virtual_channel;
+	struct v4l2_ctrl *frame_length;
+	struct v4l2_ctrl *programmed_exposure;
+	struct {
+		struct v4l2_ctrl *programmed_gain;
+		struct v4l2_ctrl *programmed_red_balance;
+		struct v4l2_ctrl *programmed_blue_balance;
+	};
+	struct v4l2_ctrl *power_estimate;
+	struct v4l2_ctrl *temperature;
+	struct v4l2_ctrl *thermal_threshold;
+	struct v4l2_ctrl *thermal_hysteresis;
 	struct v4l2_ctrl *test_pattern;
+	struct {
+		struct v4l2_ctrl *test_data_red;
+		struct v4l2_ctrl *test_data_greenr;
+		struct v4l2_ctrl *test_data_blue;
+		struct v4l2_ctrl *test_data_greenb;
+	};
+	struct v4l2_ctrl *defect_correction;
+	struct v4l2_ctrl *noise_correction;
+	struct v4l2_ctrl *data_pedestal;
+};
+
+/* Latency of a driver operation, exported through debugfs */
+struct ar1335_timing {
+	u64 count;
+	u64 last_ns;
+	u64 max_ns;
+	u64 total_ns;
+};
+
+struct ar1335_stats {
+	u64 i2c_xfers;
+	u64 i2c_bytes;
+	u64 i2c_errors;
+	/* Registers compared by write-verify, and mismatches per range */
+	u64 verify_checks;
+	u64 verify_mismatches[ARRAY_SIZE(ar1335_verify_ranges)];
+	struct ar1335_timing power_on;
+	struct ar1335_timing set_fmt;
+	struct ar1335_timing s_ctrl;
+	struct ar1335_timing stream_arm;
+	struct ar1335_timing stream_on;
+	struct ar1335_timing stream_off;
 };
 
 struct ar1335_dev {
@@ -146,26 +305,83 @@ struct ar1335_dev {
 	struct media_pad pad;
 	struct clk *extclk;
 	u32 extclk_freq;
+	/* extclk runs, it is gated in standby */
+	bool extclk_on;
+	struct delayed_work standby_work;
 	struct v4l2_subdev subdev;
 	struct v4l2_ctrl_handler ctrl_handler;
 
-	struct regulator *supplies[ARRAY_SIZE(ar1335_supply_names)];
+	struct regulator_bulk_data supplies[ARRAY_SIZE(ar1335_supply_names)];
 	struct gpio_desc *reset_gpio;
+	u32 power_on_delay_us;
+	u32 reset_delay_us;
 
 	/* lock to protect all members below */
 	struct mutex lock;
 	struct ar1335_res_struct *res_table;
 	s32 cur_res;
+	/* Achieved frame interval, and the rate last asked for */
 	struct v4l2_fract frame_rate;
+	u32 req_fps;
+	/* frame_length_lines last programmed, may exceed height + vblank */
+	u32 frame_length;
+	/* Last value written to the reset register */
+	u16 reset;
+	/* Values last programmed, reported by the programmed controls */
+	struct {
+		u16 exposure;
+		u16 gains[4];	/* green1, blue, red, green2 */
+		bool gains_set;
+	} shadow;
+	/* Read volatile controls back from the sensor, set through debugfs */
+	bool readback;
+	/* Holds a reference on ar1335_write_verify */
+	bool write_verify;
 	struct v4l2_mbus_framefmt fmt;
+	u8 skip;
+	bool low_pll;
 	struct ar1335_ctrls ctrls;
 	unsigned int lane_count;
+	/*
+	 * Link frequency of each of ar1335_mbus_codes, then of each with the
+	 * low PLL, the LINK_FREQ menu
+	 */
+	s64 link_freqs[2 * ARRAY_SIZE(ar1335_mbus_codes)];
+	/* Per device part of the power up sequence */
+	struct ar1335_reg lane_regs[3];
+	u32 virtual_channel;
+	/* Stream configuration pushed, s_stream(1) only starts the output */
+	bool armed;
+	/* Streaming with the MIPI lanes held in LP-11 */
+	bool lp11;
+	/* Snapshot in progress, back to standby after snapshot_frames */
+	struct delayed_work snapshot_work;
+	u16 snapshot_start;
+	u16 snapshot_frames;
+	/* Frame counter polling for frame sync and ctrls applied events */
+	struct delayed_work frame_work;
+	atomic_t event_subscribers;
+	u16 frame_count;
+	u32 sequence;
+	bool ctrls_pending;
+	u16 ctrls_frame;
+	/* Temperature polling while streaming, frame rate throttling */
+	struct {
+		struct delayed_work work;
+		u16 calib[2];	/* 0 when the sensor is not calibrated */
+		s32 temp;
+		u32 level;	/* frame length multiplied by 1 << level */
+	} thermal;
+	struct ar1335_stats stats;
+	struct dentry *debugfs;
 	struct {
 		u16 pre;
 		u16 mult;
 		u16 pre2;
 		u16 mult2;
 		u16 vt_pix;
+		/* PLL output, below the target when limited by AR1335_PLL_MAX */
+		u32 rate;
 	} pll;
 };
 
@@ -190,16 +406,146 @@ static u32 div64_round_up(u64 v, u32 d)
 	return div_u64(v + d - 1, d);
 }
 
-static int ar1335_code_to_bpp(struct ar1335_dev *sensor)
+static int ar1335_mbus_code_bpp(u32 code)
 {
-	switch (sensor->fmt.code) {
+	switch (code) {
 	case MEDIA_BUS_FMT_SRGGB10_1X10:
 		return 10;
+	case MEDIA_BUS_FMT_SRGGB8_1X8:
+		return 8;
 	}
 
 	return -EINVAL;
 }
 
+static int ar1335_code_to_bpp(struct ar1335_dev *sensor)
+{
+	return ar1335_mbus_code_bpp(sensor->fmt.code);
+}
+
+
+static void ar1335_timing_add(struct ar1335_timing *t, ktime_t start)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	t->count++;
+	t->last_ns = ns;
+	t->max_ns = max(t->max_ns, ns);
+	t->total_ns += ns;
+}
+
+static int ar1335_i2c_transfer(struct ar1335_dev *sensor,
+			       struct i2c_msg *msgs, int num)
+{
+	struct ar1335_stats *stats = &sensor->stats;
+	int ret, i;
+
+	ret = i2c_transfer(sensor->i2c_client->adapter, msgs, num);
+
+	stats->i2c_xfers++;
+	if (ret < 0)
+		stats->i2c_errors++;
+	else
+		for (i = 0; i < num; i++)
+			stats->i2c_bytes += msgs[i].len;
+
+	return ret;
+}
+
+static int ar1335_read_regs(struct ar1335_dev *sensor, u16 reg, u16 *vals,
+			    unsigned int count)
+{
+	struct i2c_client *client = sensor->i2c_client;
+	__be16 addr = be(reg);
+	__be16 data[4];
+	struct i2c_msg msgs[] = {
+		{
+			.addr = client->addr,
+			.flags = client->flags,
+			.buf = (u8 *)&addr,
+			.len = sizeof(addr),
+		},
+		{
+			.addr = client->addr,
+			.flags = client->flags | I2C_M_RD,
+			.buf = (u8 *)data,
+			.len = count * sizeof(data[0]),
+		},
+	};
+	unsigned int i;
+	int ret;
+
+	if (WARN_ON(count > ARRAY_SIZE(data)))
+		return -EINVAL;
+
+	ret = ar1335_i2c_transfer(sensor, msgs, ARRAY_SIZE(msgs));
+	if (ret < 0) {
+		v4l2_err(&sensor->sd, "%s: I2C read error\n", __func__);
+		return ret;
+	}
+
+	for (i = 0; i < count; i++)
+		vals[i] = be16_to_cpu(data[i]);
+	return 0;
+}
+
+static int ar1335_read_reg(struct ar1335_dev *sensor, u16 reg, u16 *val)
+{
+	return ar1335_read_regs(sensor, reg, val, 1);
+}
+
+/* Registers that don't read back what was written */
+static bool ar1335_verify_skip(u16 reg)
+{
+	switch (reg) {
+	case AR1335_REG_RESET:		/* self-clearing reset and restart */
+	case AR1335_REG_TEMPSENS_CTRL:	/* self-clearing conversion start */
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Read a burst back and compare it to what was written. Mismatches are
+ * counted, not returned: this mode observes the bus, it must not change
+ * what the driver does.
+ */
+static void ar1335_verify_regs(struct ar1335_dev *sensor, const __be16 *data,
+			       unsigned int count)
+{
+	u16 base = be16_to_cpu(data[0]);
+	unsigned int i, j, n, r;
+	u16 vals[4];
+
+	for (i = 1; i < count; i += n) {
+		u16 reg = base + 2 * (i - 1);
+
+		n = min_t(unsigned int, count - i, ARRAY_SIZE(vals));
+		if (ar1335_read_regs(sensor, reg, vals, n))
+			return;
+
+		for (j = 0; j < n; j++, reg += 2) {
+			u16 val = be16_to_cpu(data[i + j]);
+
+			if (ar1335_verify_skip(reg))
+				continue;
+
+			sensor->stats.verify_checks++;
+			if (vals[j] == val)
+				continue;
+
+			for (r = 0; r < ARRAY_SIZE(ar1335_verify_ranges); r++)
+				if (reg >= ar1335_verify_ranges[r].start &&
+				    reg <= ar1335_verify_ranges[r].end)
+					break;
+			sensor->stats.verify_mismatches[r]++;
+			dev_warn_ratelimited(&sensor->i2c_client->dev,
+					     "reg 0x%04x: wrote 0x%04x, read 0x%04x\n",
+					     reg, val, vals[j]);
+		}
+	}
+}
 
 /* Data must be BE16, the first value is the register address */
 static int ar1335_write_regs(struct ar1335_dev *sensor, const __be16 *data,
@@ -213,12 +559,16 @@ static int ar1335_write_regs(struct ar1335_dev *sensor, const __be16 *data,
 	msg.flags = client->flags;
 	msg.buf = (u8 *)data;
 	msg.len = count * sizeof(*data);
-	ret = i2c_transfer(client->adapter, &msg, 1);
+	ret = ar1335_i2c_transfer(sensor, &msg, 1);
 
 	if (ret < 0) {
 		v4l2_err(&sensor->sd, "%s: I2C write error\n", __func__);
 		return ret;
 	}
+
+	if (static_branch_unlikely(&ar1335_write_verify) &&
+	    sensor->write_verify)
+		ar1335_verify_regs(sensor, data, count);
 	return 0;
 }
 
@@ -229,28 +579,344 @@ static int ar1335_write_reg(struct ar1335_dev *sensor, u16 reg, u16 val)
 	return ar1335_write_regs(sensor, buf, 2);
 }
 
+static int ar1335_update_reg(struct ar1335_dev *sensor, u16 reg, u16 mask,
+			     u16 val)
+{
+	u16 old;
+	int ret;
+
+	ret = ar1335_read_reg(sensor, reg, &old);
+	if (ret)
+		return ret;
+
+	val = (old & ~mask) | (val & mask);
+	if (val == old)
+		return 0;
+
+	return ar1335_write_reg(sensor, reg, val);
+}
+
+static int ar1335_set_reset(struct ar1335_dev *sensor, u16 val)
+{
+	int ret;
+
+	lockdep_assert_held(&sensor->lock);
+
+	ret = ar1335_write_reg(sensor, AR1335_REG_RESET, val);
+	if (ret)
+		return ret;
+
+	sensor->reset = val;
+	return 0;
+}
+
+/* Latch the registers written while held at the same frame boundary */
+static int ar1335_group_hold(struct ar1335_dev *sensor, bool hold)
+{
+	lockdep_assert_held(&sensor->lock);
+
+	return ar1335_write_reg(sensor, AR1335_REG_RESET, sensor->reset |
+				(hold ? AR1335_REG_RESET_GROUP_PARAM_HOLD : 0));
+}
+
+/* PLL output, the bit rate of each lane, needed for a bit depth */
+static u32 __ar1335_target_vco(struct ar1335_dev *sensor, unsigned int bpp)
+{
+	unsigned int pixel_clock;
+
+	pixel_clock = AR1335_PIXEL_CLOCK_RATE * 2 / sensor->lane_count;
+	return pixel_clock * (bpp / 2);
+}
+
+/* PLL output needed for the current format and lane count */
+static u32 ar1335_target_vco(struct ar1335_dev *sensor)
+{
+	return __ar1335_target_vco(sensor, ar1335_code_to_bpp(sensor));
+}
+
+/*
+ * PLL output to aim for. With few lanes the target may exceed the VCO
+ * range. Run at the maximum then, which lowers the frame rate instead of
+ * overrunning the link.
+ */
+static u32 __ar1335_pll_target(struct ar1335_dev *sensor, unsigned int bpp,
+			       bool low_pll)
+{
+	u32 vco = min_t(u32, __ar1335_target_vco(sensor, bpp), AR1335_PLL_MAX);
+
+	return low_pll ? min_t(u32, vco, AR1335_PLL_MIN) : vco;
+}
+
+static u32 ar1335_pll_target(struct ar1335_dev *sensor)
+{
+	return __ar1335_pll_target(sensor, ar1335_code_to_bpp(sensor),
+				   sensor->low_pll);
+}
+
+/*
+ * Array pixel rate. The array and the MIPI link are clocked by the same
+ * PLL, so a PLL below its target slows readout down to what the lanes can
+ * carry.
+ */
+static u32 ar1335_pixel_rate(struct ar1335_dev *sensor)
+{
+	return div_u64((u64)AR1335_PIXEL_CLOCK_RATE * AR1335_PIXELS_PER_CLOCK *
+		       sensor->pll.rate, ar1335_target_vco(sensor));
+}
+
+static u32 ar1335_line_time_ns(struct ar1335_dev *sensor)
+{
+	u32 line_length = sensor->fmt.width + sensor->ctrls.hblank->val;
+
+	return div_u64((u64)line_length * NSEC_PER_SEC,
+		       ar1335_pixel_rate(sensor));
+}
+
+/* Flicker period in lines, 0 when anti-flicker is disabled */
+static u32 ar1335_flicker_lines(struct ar1335_dev *sensor)
+{
+	u32 hz;
+
+	switch (sensor->ctrls.power_line_freq->val) {
+	case V4L2_CID_POWER_LINE_FREQUENCY_50HZ:
+		hz = 50;
+		break;
+	case V4L2_CID_POWER_LINE_FREQUENCY_60HZ:
+		hz = 60;
+		break;
+	default:
+		return 0;
+	}
+
+	/* The light intensity peaks twice per mains cycle */
+	return DIV_ROUND_CLOSEST(NSEC_PER_SEC / (2 * hz),
+				 ar1335_line_time_ns(sensor));
+}
+
+/* Nominal frame length, stretched while thermally throttled */
+static u32 ar1335_min_frame_length(struct ar1335_dev *sensor)
+{
+	u32 fll = sensor->fmt.height + sensor->ctrls.vblank->val;
+
+	return min_t(u32, fll << sensor->thermal.level,
+		     AR1335_TOTAL_HEIGHT_MAX);
+}
+
+/*
+ * Longest frame exposure may stretch to: the auto frame rate minimum when
+ * enabled, otherwise only what anti-flicker rounding needs.
+ */
+static u32 ar1335_max_frame_length(struct ar1335_dev *sensor)
+{
+	u32 fll = ar1335_min_frame_length(sensor);
+	u32 max_fll;
+
+	if (!sensor->ctrls.auto_frame_rate->val)
+		return AR1335_TOTAL_HEIGHT_MAX;
+
+	max_fll = NSEC_PER_SEC / sensor->ctrls.min_frame_rate->val /
+		  ar1335_line_time_ns(sensor);
+	return clamp(max_fll, fll, AR1335_TOTAL_HEIGHT_MAX);
+}
+
+/*
+ * Compute the exposure and frame length to program. With anti-flicker
+ * enabled, exposures of at least one flicker period are rounded to a whole
+ * number of periods. The frame is stretched when the exposure no longer
+ * fits, which with auto frame rate lowers the frame rate.
+ */
+static u32 ar1335_calc_exposure(struct ar1335_dev *sensor, u32 *exposure)
+{
+	u32 fll = ar1335_min_frame_length(sensor);
+	u32 exp_max = ar1335_max_frame_length(sensor) - AR1335_EXPOSURE_MARGIN;
+	u32 period = ar1335_flicker_lines(sensor);
+	u32 exp = min_t(u32, sensor->ctrls.exposure->val, exp_max);
+
+	if (period && exp >= period) {
+		u32 n = DIV_ROUND_CLOSEST(exp, period);
+
+		n = min(n, exp_max / period);
+		exp = n * period;
+	}
+
+	*exposure = exp;
+	return max(fll, exp + AR1335_EXPOSURE_MARGIN);
+}
+
+/* Vertical blanking giving the requested frame rate at the current line time */
+static s32 ar1335_fps_to_vblank(struct ar1335_dev *sensor, u32 fps)
+{
+	u32 frame_length = NSEC_PER_SEC / fps / ar1335_line_time_ns(sensor);
+
+	return clamp_t(s32, frame_length - sensor->fmt.height,
+		       sensor->ctrls.vblank->minimum,
+		       AR1335_TOTAL_HEIGHT_MAX - sensor->fmt.height);
+}
+
+/*
+ * Report the frame interval of the frame length programmed, including
+ * stretching by auto frame rate and anti-flicker. Call it whenever the
+ * blankings, the exposure or the frame length limits change.
+ */
+static void ar1335_update_frame_rate(struct ar1335_dev *sensor)
+{
+	u32 exposure;
+	u64 frame = (u64)(sensor->fmt.width + sensor->ctrls.hblank->val) *
+		    ar1335_calc_exposure(sensor, &exposure);
+	u32 rate = ar1335_pixel_rate(sensor);
+	u32 rem, div;
+
+	lockdep_assert_held(&sensor->lock);
+
+	div_u64_rem(frame, rate, &rem);
+	div = gcd(rate, rem);
+
+	sensor->frame_rate.numerator = div_u64(frame, div);
+	sensor->frame_rate.denominator = rate / div;
+}
+
+/*
+ * Estimated sensor power in uW for the current state. The readout and
+ * MIPI terms scale with the frame length actually programmed, so auto
+ * frame rate and anti-flicker stretching lower the estimate.
+ */
+static u32 ar1335_power_estimate(struct ar1335_dev *sensor)
+{
+	u32 fll = sensor->frame_length ? :
+		  sensor->fmt.height + sensor->ctrls.vblank->val;
+	u64 frame_ns = (u64)fll * ar1335_line_time_ns(sensor);
+	u64 pixels, bits;
+	u32 power;
+
+	lockdep_assert_held(&sensor->lock);
+
+	if (!sensor->extclk_on)
+		return AR1335_POWER_STANDBY_UW;
+
+	power = AR1335_POWER_IDLE_UW +
+		sensor->pll.rate / 1000000 * AR1335_POWER_PLL_UW_PER_MHZ;
+	if (!(sensor->reset & AR1335_REG_RESET_STREAM) || !frame_ns)
+		return power;
+
+	/* Pixels read from the array and sent per second */
+	pixels = div64_u64((u64)sensor->fmt.width * sensor->fmt.height *
+			   NSEC_PER_SEC, frame_ns);
+	power += div_u64(pixels * sensor->skip * sensor->skip *
+			 AR1335_POWER_PIXEL_PJ, 1000000);
+
+	power += sensor->lane_count * AR1335_POWER_LANE_UW;
+	if (!sensor->lp11) {
+		bits = pixels * ar1335_code_to_bpp(sensor);
+		power += div_u64(bits * AR1335_POWER_BIT_PJ, 1000000);
+	}
+
+	return min_t(u32, power, AR1335_POWER_MAX_UW);
+}
+
+static int ar1335_update_exposure_range(struct ar1335_dev *sensor)
+{
+	struct v4l2_ctrl *exposure = sensor->ctrls.exposure;
+	u32 fll = sensor->fmt.height + sensor->ctrls.vblank->val;
+	u32 max;
+
+	if (sensor->ctrls.auto_frame_rate->val)
+		fll = ar1335_max_frame_length(sensor);
+	max = fll - AR1335_EXPOSURE_MARGIN;
+
+	/* The default must stay within the range for short frames */
+	return __v4l2_ctrl_modify_range(exposure, exposure->minimum, max,
+					exposure->step,
+					min_t(s64, exposure->default_value,
+					      max));
+}
+
 static int ar1335_set_geometry(struct ar1335_dev *sensor)
 {
+	/* Size of the array area read out, before skipping */
+	u16 width = sensor->fmt.width * sensor->skip;
+	u16 height = sensor->fmt.height * sensor->skip;
 	/* Center the image in the visible output window. */
-	u16 x = clamp((AR1335_WIDTH_MAX - sensor->fmt.width) / 2,
+	u16 x = clamp((AR1335_WIDTH_MAX - width) / 2,
 		       AR1335_MIN_X_ADDR_START, AR1335_MAX_X_ADDR_END);
-	u16 y = clamp(((AR1335_HEIGHT_MAX - sensor->fmt.height) / 2) & ~1,
+	u16 y = clamp(((AR1335_HEIGHT_MAX - height) / 2) & ~1,
 		       AR1335_MIN_Y_ADDR_START, AR1335_MAX_Y_ADDR_END);
+	/* Skipping by n reads one out of n Bayer pairs */
+	u16 odd_inc = 2 * sensor->skip - 1;
+	u32 exposure;
+	u32 frame_length = ar1335_calc_exposure(sensor, &exposure);
+	int ret;
 
 	/* All dimensions are unsigned 12-bit integers */
 	__be16 regs[] = {
 		be(AR1335_REG_FRAME_LENGTH_LINES),
-		be(sensor->fmt.height + sensor->ctrls.vblank->val),
+		be(frame_length),
 		be(sensor->fmt.width + sensor->ctrls.hblank->val),
 		be(x),
 		be(y),
-		be(x + sensor->fmt.width - 1),
-		be(y + sensor->fmt.height - 1),
+		be(x + width - 1),
+		be(y + height - 1),
 		be(sensor->fmt.width),
 		be(sensor->fmt.height)
 	};
-	return ar1335_write_regs(sensor, regs, ARRAY_SIZE(regs));
+	__be16 inc_regs[] = {
+		be(AR1335_REG_X_EVEN_INC),
+		/* 0x380 */ be(1), /* x_even_inc */
+		/* 0x382 */ be(odd_inc), /* x_odd_inc */
+		/* 0x384 */ be(1), /* y_even_inc */
+		/* 0x386 */ be(odd_inc) /* y_odd_inc */
+	};
+
+	lockdep_assert_held(&sensor->lock);
+
+	ret = ar1335_write_regs(sensor, regs, ARRAY_SIZE(regs));
+	if (ret)
+		return ret;
+
+	ret = ar1335_write_regs(sensor, inc_regs, ARRAY_SIZE(inc_regs));
+	if (ret)
+		return ret;
+
+	sensor->frame_length = frame_length;
+	return 0;
+}
+
+static int ar1335_set_exposure(struct ar1335_dev *sensor)
+{
+	u32 exposure, frame_length;
+	int ret, err;
+
+	lockdep_assert_held(&sensor->lock);
+
+	frame_length = ar1335_calc_exposure(sensor, &exposure);
+	if (frame_length == sensor->frame_length) {
+		ret = ar1335_write_reg(sensor,
+				       AR1335_REG_COARSE_INTEGRATION_TIME,
+				       exposure);
+		if (!ret)
+			sensor->shadow.exposure = exposure;
+		return ret;
+	}
+
+	/* Apply both in the same frame so no frame is over-exposed */
+	ret = ar1335_group_hold(sensor, true);
+	if (ret)
+		return ret;
+
+	ret = ar1335_write_reg(sensor, AR1335_REG_FRAME_LENGTH_LINES,
+			       frame_length);
+	if (!ret)
+		ret = ar1335_write_reg(sensor,
+				       AR1335_REG_COARSE_INTEGRATION_TIME,
+				       exposure);
+	if (!ret) {
+		sensor->frame_length = frame_length;
+		sensor->shadow.exposure = exposure;
+	}
+
+	err = ar1335_group_hold(sensor, false);
+	return ret ? ret : err;
 }
+
 static int ar1335_set_gains(struct ar1335_dev *sensor)
 {
 	int green = sensor->ctrls.gain->val;
@@ -259,6 +925,8 @@ static int ar1335_set_gains(struct ar1335_dev *sensor)
 	unsigned int gain = min(red, min(green, blue));
 	unsigned int analog = min(gain, 64u); /* range is 0 - 127 */
 	__be16 regs[5];
+	unsigned int i;
+	int ret;
 
 	red   = min(red   - analog + 64, 511u);
 	green = min(green - analog + 64, 511u);
@@ -268,7 +936,14 @@ static int ar1335_set_gains(struct ar1335_dev *sensor)
 	regs[2] = be(blue  << 7 | analog);
 	regs[3] = be(red   << 7 | analog);
 	regs[4] = be(green << 7 | analog);
-	return ar1335_write_regs(sensor, regs, ARRAY_SIZE(regs));
+	ret = ar1335_write_regs(sensor, regs, ARRAY_SIZE(regs));
+	if (ret)
+		return ret;
+
+	for (i = 0; i < ARRAY_SIZE(sensor->shadow.gains); i++)
+		sensor->shadow.gains[i] = be16_to_cpu(regs[i + 1]);
+	sensor->shadow.gains_set = true;
+	return 0;
 }
 
 static u32 calc_pll(struct ar1335_dev *sensor, u32 freq, u16 *pre_ptr, u16 *mult_ptr)
@@ -307,21 +982,47 @@ static u32 calc_pll(struct ar1335_dev *sensor, u32 freq, u16 *pre_ptr, u16 *mult
 
 static void ar1335_calc_pll(struct ar1335_dev *sensor)
 {
-	unsigned int pixel_clock;
+	u32 vco = ar1335_pll_target(sensor);
 	u16 pre, mult;
-	u32 vco;
-	int bpp;
-	pixel_clock = AR1335_PIXEL_CLOCK_RATE * 2 / sensor->lane_count;
-	bpp = ar1335_code_to_bpp(sensor);
-	sensor->pll.vt_pix = bpp / 2;
-	vco = pixel_clock * sensor->pll.vt_pix;
 
-	calc_pll(sensor, vco, &pre, &mult);
+	sensor->pll.vt_pix = ar1335_code_to_bpp(sensor) / 2;
+	sensor->pll.rate = calc_pll(sensor, vco, &pre, &mult);
 
 	sensor->pll.pre = sensor->pll.pre2 = pre;
 	sensor->pll.mult = sensor->pll.mult2 = mult;
 }
 
+/* CSI-2 link frequency for a bit depth, DDR carries two bits per clock */
+static s64 ar1335_link_freq(struct ar1335_dev *sensor, unsigned int bpp,
+			    bool low_pll)
+{
+	u32 vco = __ar1335_pll_target(sensor, bpp, low_pll);
+	u16 pre, mult;
+
+	return calc_pll(sensor, vco, &pre, &mult) / 2;
+}
+
+/* Report the rates ar1335_calc_pll() settled on to the receiver */
+static int ar1335_update_link_ctrls(struct ar1335_dev *sensor)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < ARRAY_SIZE(ar1335_mbus_codes) - 1; i++)
+		if (ar1335_mbus_codes[i] == sensor->fmt.code)
+			break;
+	if (sensor->low_pll)
+		i += ARRAY_SIZE(ar1335_mbus_codes);
+
+	ret = __v4l2_ctrl_s_ctrl(sensor->ctrls.link_freq, i);
+	if (ret)
+		return ret;
+
+	return __v4l2_ctrl_s_ctrl_int64(sensor->ctrls.pixrate,
+					ar1335_pixel_rate(sensor));
+}
+
+/* The PLL settings are computed by ar1335_calc_pll() at set_fmt time */
 static int ar1335_pll_config(struct ar1335_dev *sensor)
 {
 	__be16 pll_regs[] = {
@@ -333,51 +1034,171 @@ static int ar1335_pll_config(struct ar1335_dev *sensor)
 		/* 0x308 */ be(sensor->pll.vt_pix * 2), /* op_pix_clk_div = 2 * vt_pix_clk_div */
 		/* 0x30A */ be(1)  /* op_sys_clk_div */
 	};
-	ar1335_calc_pll(sensor);
 	return ar1335_write_regs(sensor, pll_regs, ARRAY_SIZE(pll_regs));
 }
 
-static int ar1335_set_stream(struct ar1335_dev *sensor, bool on)
+/* Time until the next frame boundary, at least one tick */
+static unsigned long ar1335_frame_jiffies(struct ar1335_dev *sensor)
 {
-	int ret;
-	if (on) {
-		/* Stop streaming for just a moment */
-		ret = ar1335_write_reg(sensor, AR1335_REG_RESET,
-				       AR1335_REG_RESET_DEFAULTS);
-		if (ret)
-			return ret;
+	u64 ns = (u64)ar1335_line_time_ns(sensor) * sensor->frame_length;
 
-		ret = ar1335_set_geometry(sensor);
-		if (ret)
-			return ret;
+	return max(nsecs_to_jiffies(ns), 1UL);
+}
 
-		ret = ar1335_pll_config(sensor);
-		if (ret)
-			goto err;
+static void ar1335_sleep_us(u32 us)
+{
+	if (us)
+		usleep_range(us, us + us / 10 + 1);
+}
 
-		ret =  __v4l2_ctrl_handler_setup(&sensor->ctrls.handler);
-		if (ret)
-			goto err;
+static int ar1335_extclk_enable(struct ar1335_dev *sensor)
+{
+	int ret;
 
-		/* Exit LP-11 mode on clock and data lanes */
-		ret = ar1335_write_reg(sensor, AR1335_REG_HISPI_CONTROL_STATUS,
-				       0);
-		if (ret)
-			goto err;
+	if (sensor->extclk_on)
+		return 0;
 
-		/* Start streaming */
-		ret = ar1335_write_reg(sensor, AR1335_REG_RESET,
-				       AR1335_REG_RESET_DEFAULTS |
-				       AR1335_REG_RESET_STREAM);
+	ret = clk_prepare_enable(sensor->extclk);
+	if (ret)
+		return ret;
+
+	sensor->extclk_on = true;
+	ar1335_sleep_us(AR1335_EXTCLK_SETTLE_US);
+	return 0;
+}
+
+static void ar1335_extclk_disable(struct ar1335_dev *sensor)
+{
+	if (!sensor->extclk_on)
+		return;
+
+	clk_disable_unprepare(sensor->extclk);
+	sensor->extclk_on = false;
+}
+
+/*
+ * Gate extclk once the sensor has finished its last frame and sits in
+ * software standby. Registers are retained while the clock is stopped.
+ */
+static void ar1335_standby_work(struct work_struct *work)
+{
+	struct ar1335_dev *sensor = container_of(to_delayed_work(work),
+						 struct ar1335_dev,
+						 standby_work);
+
+	mutex_lock(&sensor->lock);
+	if (!(sensor->reset & AR1335_REG_RESET_STREAM) && !sensor->armed)
+		ar1335_extclk_disable(sensor);
+	mutex_unlock(&sensor->lock);
+}
+
+/*
+ * Push the complete stream configuration (geometry, PLL and all controls)
+ * while the sensor is stopped, leaving only the streaming bit to flip.
+ */
+static int ar1335_arm_stream(struct ar1335_dev *sensor)
+{
+	int bpp, ret;
+
+	lockdep_assert_held(&sensor->lock);
+
+	/* Controls set while gated are applied by the handler setup below */
+	ret = ar1335_extclk_enable(sensor);
+	if (ret)
+		return ret;
+
+	/* Stop streaming for just a moment */
+	ret = ar1335_set_reset(sensor, AR1335_REG_RESET_DEFAULTS);
+	if (ret)
+		return ret;
+
+	ret = ar1335_set_geometry(sensor);
+	if (ret)
+		return ret;
+
+	ret = ar1335_pll_config(sensor);
+	if (ret)
+		return ret;
+
+	/* Output bit depth, matching the PLL dividers */
+	bpp = ar1335_code_to_bpp(sensor);
+	ret = ar1335_write_reg(sensor, AR1335_REG_DATA_FORMAT,
+			       (bpp << 8) | bpp);
+	if (ret)
+		return ret;
+
+	ret =  __v4l2_ctrl_handler_setup(&sensor->ctrls.handler);
+	if (ret)
+		return ret;
+
+	if (sensor->thermal.calib[0]) {
+		ret = ar1335_write_reg(sensor, AR1335_REG_TEMPSENS_CTRL,
+				       AR1335_REG_TEMPSENS_CTRL_ENABLE |
+				       AR1335_REG_TEMPSENS_CTRL_START);
+		if (ret)
+			return ret;
+	}
+
+	sensor->armed = true;
+	return 0;
+}
+
+static int ar1335_set_stream(struct ar1335_dev *sensor, bool on)
+{
+	int ret;
+
+	lockdep_assert_held(&sensor->lock);
+
+	if (on) {
+		/*
+		 * When pre_streamon already armed the sensor, it is streaming
+		 * in LP-11 and leaving LP-11 is all that's left to do.
+		 */
+		if (!sensor->armed) {
+			ret = ar1335_arm_stream(sensor);
+			if (ret)
+				goto err;
+		}
+
+		/* Exit LP-11 mode on clock and data lanes */
+		ret = ar1335_write_reg(sensor, AR1335_REG_HISPI_CONTROL_STATUS,
+				       0);
 		if (ret)
 			goto err;
 
+		if (!sensor->lp11) {
+			/* Start streaming */
+			ret = ar1335_set_reset(sensor,
+					       AR1335_REG_RESET_DEFAULTS |
+					       AR1335_REG_RESET_STREAM);
+			if (ret)
+				goto err;
+		}
+
+		sensor->armed = false;
+		sensor->lp11 = false;
 		return 0;
 
 err:
+		/* Don't leave the sensor streaming in LP-11 behind */
+		if (sensor->reset & AR1335_REG_RESET_STREAM)
+			ar1335_set_stream(sensor, false);
+		sensor->armed = false;
+		sensor->lp11 = false;
 		return ret;
 
 	} else {
+		/* A new stream starts unthrottled, thermal work re-evaluates */
+		if (sensor->thermal.level) {
+			sensor->thermal.level = 0;
+			ar1335_update_exposure_range(sensor);
+			ar1335_update_frame_rate(sensor);
+		}
+
+		/* Already in standby with the clock gated */
+		if (!sensor->extclk_on)
+			return 0;
+
 		/*
 		 * Reset gain, the sensor may produce all white pixels without
 		 * this
@@ -387,29 +1208,235 @@ err:
 			return ret;
 
 		/* Stop streaming */
-		ret = ar1335_write_reg(sensor, AR1335_REG_RESET,
-				       AR1335_REG_RESET_DEFAULTS);
+		sensor->armed = false;
+		sensor->lp11 = false;
+		ret = ar1335_set_reset(sensor, AR1335_REG_RESET_DEFAULTS);
 		if (ret)
 			return ret;
 
+		/* Standby is entered at the end of the frame in progress */
+		schedule_delayed_work(&sensor->standby_work,
+				      ar1335_frame_jiffies(sensor));
+
 		//pm_runtime_put(&sensor->i2c_client->dev);
 		return 0;
 	}
 }
 
+/*
+ * The frame counter counts started frames. Stop streaming as soon as the
+ * last requested frame has started, clearing the streaming bit lets it
+ * complete. Polling twice per frame catches it before the next one starts.
+ */
+static void ar1335_snapshot_work(struct work_struct *work)
+{
+	struct ar1335_dev *sensor = container_of(to_delayed_work(work),
+						 struct ar1335_dev,
+						 snapshot_work);
+	u16 count;
+	int ret;
+
+	mutex_lock(&sensor->lock);
+
+	ret = ar1335_read_reg(sensor, AR1335_REG_FRAME_COUNT, &count);
+	if (!ret && (u16)(count - sensor->snapshot_start) <
+		    sensor->snapshot_frames) {
+		schedule_delayed_work(&sensor->snapshot_work,
+				      max(ar1335_frame_jiffies(sensor) / 2, 1UL));
+		goto out;
+	}
+
+	ret = ar1335_set_stream(sensor, false);
+	if (ret)
+		dev_err(&sensor->i2c_client->dev,
+			"failed to stop snapshot: %d\n", ret);
+out:
+	mutex_unlock(&sensor->lock);
+}
+
+/* Frames are being sent and someone listens for frame events */
+static bool ar1335_frame_events(struct ar1335_dev *sensor)
+{
+	return (sensor->reset & AR1335_REG_RESET_STREAM) && !sensor->lp11 &&
+	       atomic_read(&sensor->event_subscribers);
+}
+
+static void ar1335_queue_event(struct ar1335_dev *sensor, u32 type)
+{
+	struct v4l2_event ev = {
+		.type = type,
+		.u.frame_sync.frame_sequence = sensor->sequence,
+	};
+
+	v4l2_subdev_notify_event(&sensor->sd, &ev);
+}
+
+/*
+ * Without an interrupt from the sensor, poll the frame counter twice per
+ * frame while streaming and events are subscribed.
+ */
+static void ar1335_frame_work(struct work_struct *work)
+{
+	struct ar1335_dev *sensor = container_of(to_delayed_work(work),
+						 struct ar1335_dev,
+						 frame_work);
+	u16 count;
+
+	mutex_lock(&sensor->lock);
+
+	if (!ar1335_frame_events(sensor))
+		goto out;
+
+	if (!ar1335_read_reg(sensor, AR1335_REG_FRAME_COUNT, &count)) {
+		if (count != sensor->frame_count) {
+			sensor->sequence += (u16)(count - sensor->frame_count);
+			sensor->frame_count = count;
+			ar1335_queue_event(sensor, V4L2_EVENT_FRAME_SYNC);
+		}
+
+		if (sensor->ctrls_pending &&
+		    (s16)(count - sensor->ctrls_frame) >= 0) {
+			sensor->ctrls_pending = false;
+			ar1335_queue_event(sensor,
+					   V4L2_EVENT_AR1335_CTRLS_APPLIED);
+		}
+	}
+
+	schedule_delayed_work(&sensor->frame_work,
+			      max(ar1335_frame_jiffies(sensor) / 2, 1UL));
+out:
+	mutex_unlock(&sensor->lock);
+}
+
+/* Read the last conversion in C and start the next one */
+static int ar1335_read_temp(struct ar1335_dev *sensor, s32 *temp)
+{
+	s32 c1 = sensor->thermal.calib[0], c2 = sensor->thermal.calib[1];
+	u16 val;
+	int ret;
+
+	ret = ar1335_read_reg(sensor, AR1335_REG_TEMPSENS_DATA, &val);
+	if (ret)
+		return ret;
+
+	*temp = AR1335_TEMPSENS_CALIB1_TEMP +
+		DIV_ROUND_CLOSEST(((s32)val - c1) *
+				  (AR1335_TEMPSENS_CALIB2_TEMP -
+				   AR1335_TEMPSENS_CALIB1_TEMP), c2 - c1);
+
+	return ar1335_write_reg(sensor, AR1335_REG_TEMPSENS_CTRL,
+				AR1335_REG_TEMPSENS_CTRL_ENABLE |
+				AR1335_REG_TEMPSENS_CTRL_START);
+}
+
+/*
+ * Step the frame rate down one level per poll while at or above the
+ * threshold, and back up once the temperature dropped by the hysteresis.
+ */
+static void ar1335_thermal_work(struct work_struct *work)
+{
+	struct ar1335_dev *sensor = container_of(to_delayed_work(work),
+						 struct ar1335_dev,
+						 thermal.work);
+	s32 threshold, temp;
+	u32 level;
+	int ret;
+
+	mutex_lock(&sensor->lock);
+
+	if (!(sensor->reset & AR1335_REG_RESET_STREAM))
+		goto out;
+
+	if (ar1335_read_temp(sensor, &temp))
+		goto reschedule;
+	sensor->thermal.temp = temp;
+
+	threshold = sensor->ctrls.thermal_threshold->val;
+	level = sensor->thermal.level;
+	if (temp >= threshold && level < AR1335_THERMAL_LEVEL_MAX)
+		level++;
+	else if (temp <= threshold - sensor->ctrls.thermal_hysteresis->val &&
+		 level > 0)
+		level--;
+
+	if (level != sensor->thermal.level) {
+		struct v4l2_event ev = {
+			.type = V4L2_EVENT_AR1335_THERMAL,
+			.u.data = { level, clamp(temp, -128, 127) },
+		};
+
+		sensor->thermal.level = level;
+		ret = ar1335_update_exposure_range(sensor);
+		if (!ret)
+			ret = ar1335_set_exposure(sensor);
+		ar1335_update_frame_rate(sensor);
+		if (ret)
+			dev_err(&sensor->i2c_client->dev,
+				"failed to throttle to level %u: %d\n",
+				level, ret);
+
+		dev_info(&sensor->i2c_client->dev,
+			 "%d C, thermal throttle level %u\n", temp, level);
+		v4l2_subdev_notify_event(&sensor->sd, &ev);
+	}
+
+reschedule:
+	schedule_delayed_work(&sensor->thermal.work,
+			      msecs_to_jiffies(AR1335_THERMAL_POLL_MS));
+out:
+	mutex_unlock(&sensor->lock);
+}
+
 static struct ar1335_res_struct ar1335_res_table[] = {
+	{
+		/*
+		 * Motion watch: a 2560x1440 window skipped 4x at a low rate,
+		 * with the PLL at its minimum
+		 */
+		.width = 640,
+		.height = 360,
+		.fps = 5,
+		.skip = 4,
+		.exact = true,
+		.low_pll = true,
+		.defect_correction = false,
+		.noise_correction = false,
+	},
 	{
 		.width = 1920,
 		.height = 1080,
+		.skip = 1,
+		.defect_correction = true,
+		.noise_correction = true,
 	},
 	{
 		.width = 3840,
 		.height = 2160,
+		.skip = 1,
+		.defect_correction = true,
+		.noise_correction = true,
 	}
 };
 
 
-static int ar1335_match_resolution(struct v4l2_mbus_framefmt *fmt)
+/*
+ * The payload of a mode at its lowest frame rate must fit in lane count x
+ * link frequency x 2 (DDR) at the highest PLL output the mode uses. Higher
+ * rates are then limited by the line time, see ar1335_pixel_rate().
+ */
+static bool ar1335_mode_fits_link(struct ar1335_dev *sensor,
+				  const struct ar1335_res_struct *res,
+				  u32 code)
+{
+	u64 bits = (u64)res->width * res->height *
+		   (res->fps ?: MIN_FRAME_RATE) * ar1335_mbus_code_bpp(code);
+
+	return bits <= (u64)sensor->lane_count *
+		       (res->low_pll ? AR1335_PLL_MIN : AR1335_PLL_MAX);
+}
+
+static int ar1335_match_resolution(struct ar1335_dev *sensor,
+				   struct v4l2_mbus_framefmt *fmt)
 {
 	s32 w0, h0, mismatch, distance;
 	s32 w1 = fmt->width;
@@ -423,6 +1450,14 @@ static int ar1335_match_resolution(struct v4l2_mbus_framefmt *fmt)
 	for (i = 0; i < ARRAY_SIZE(ar1335_res_table); i++) {
 		w0 = ar1335_res_table[i].width;
 		h0 = ar1335_res_table[i].height;
+		if (!ar1335_mode_fits_link(sensor, &ar1335_res_table[i],
+					   fmt->code))
+			continue;
+		if (ar1335_res_table[i].exact) {
+			if (w0 == w1 && h0 == h1)
+				return i;
+			continue;
+		}
 		if (w0 < w1 || h0 < h1)
 			continue;
 		mismatch = abs(w0 * h1 - w1 * h0) * 8192 / w1 / h0;
@@ -439,16 +1474,36 @@ static int ar1335_match_resolution(struct v4l2_mbus_framefmt *fmt)
 	return idx;
 }
 
+static int ar1335_set_mode_default(struct v4l2_ctrl *ctrl, s32 def)
+{
+	int ret;
+
+	ret = __v4l2_ctrl_modify_range(ctrl, ctrl->minimum, ctrl->maximum,
+				       ctrl->step, def);
+	if (ret)
+		return ret;
+
+	return __v4l2_ctrl_s_ctrl(ctrl, def);
+}
+
 static s32 ar1335_try_mbus_fmt_locked(struct v4l2_subdev *sd,
 				      struct v4l2_mbus_framefmt *fmt)
 {
-	s32 res_num, idx = -1;
+	struct ar1335_dev *sensor = to_ar1335_dev(sd);
+	s32 res_num, i, idx = -1;
 
 	res_num = ARRAY_SIZE(ar1335_res_table);
 
 	if (fmt->width <= ar1335_res_table[res_num - 1].width &&
 	    fmt->height <= ar1335_res_table[res_num - 1].height)
-		idx = ar1335_match_resolution(fmt);
+		idx = ar1335_match_resolution(sensor, fmt);
+
+	/* Otherwise the largest mode the link can carry */
+	for (i = res_num - 1; idx == -1 && i >= 0; i--)
+		if (!ar1335_res_table[i].exact &&
+		    ar1335_mode_fits_link(sensor, &ar1335_res_table[i],
+					  fmt->code))
+			idx = i;
 	if (idx == -1)
 		idx = res_num - 1;
 
@@ -463,7 +1518,7 @@ static void ar1335_adj_fmt(struct v4l2_mbus_framefmt *fmt)
 			   AR1335_WIDTH_MAX);
 	fmt->height = clamp(ALIGN(fmt->height, 4), AR1335_HEIGHT_MIN,
 			    AR1335_HEIGHT_MAX);
-	fmt->code = MEDIA_BUS_FMT_SGRBG10_1X10;
+	fmt->code = ar1335_mbus_codes[0];
 	fmt->field = V4L2_FIELD_NONE;
 	fmt->colorspace = V4L2_COLORSPACE_SRGB;
 	fmt->ycbcr_enc = V4L2_YCBCR_ENC_DEFAULT;
@@ -471,68 +1526,67 @@ static void ar1335_adj_fmt(struct v4l2_mbus_framefmt *fmt)
 	fmt->xfer_func = V4L2_XFER_FUNC_DEFAULT;
 }
 
-static int ar1335_get_fmt(struct v4l2_subdev *sd,
-			  struct v4l2_subdev_state *sd_state,
-			  struct v4l2_subdev_format *format)
-{
-	struct v4l2_mbus_framefmt *fmt = &format->format;
-	struct ar1335_dev *sensor = to_ar1335_dev(sd);
-	if (format->pad)
-		return -EINVAL;
-
-	mutex_lock(&sensor->lock);
-	fmt->width = sensor->fmt.width;
-	fmt->height = sensor->fmt.height;
-	fmt->code = sensor->fmt.code;
-	fmt->field = sensor->fmt.field;
-	mutex_unlock(&sensor->lock);
-	return 0;
-}
 
 static int ar1335_set_fmt(struct v4l2_subdev *sd,
 			  struct v4l2_subdev_state *sd_state,
 			  struct v4l2_subdev_format *format)
 {
-	struct i2c_client *client = v4l2_get_subdevdata(sd);
 	struct ar1335_dev *sensor = to_ar1335_dev(sd);
 	struct v4l2_mbus_framefmt *fmt = &format->format;
-	int max_vblank, max_hblank;
+	int max_vblank, max_hblank, vblank, hblank;
+	ktime_t start = ktime_get();
+	bool mode_changed;
 	s32 idx, ret = 0;
-	mutex_lock(&sensor->lock);
 
+	/* The subdev core holds the lock of sd_state */
+	if (fmt->code != MEDIA_BUS_FMT_SRGGB10_1X10 &&
+	    fmt->code != MEDIA_BUS_FMT_SRGGB8_1X8)
+		fmt->code = ar1335_mbus_codes[0];
+	idx = ar1335_try_mbus_fmt_locked(sd, fmt);
+	fmt->field = V4L2_FIELD_NONE;
+	fmt->colorspace = V4L2_COLORSPACE_SRGB;
+	fmt->ycbcr_enc = V4L2_YCBCR_ENC_DEFAULT;
+	fmt->quantization = V4L2_QUANTIZATION_FULL_RANGE;
+	fmt->xfer_func = V4L2_XFER_FUNC_DEFAULT;
+
+	/* TRY formats live in the file handle state only */
 	if (format->which == V4L2_SUBDEV_FORMAT_TRY) {
-        ar1335_try_mbus_fmt_locked(sd, fmt);
-        #ifdef V4L2_SUBDEV_PAD_CONFIG_HAS_TRY_FMT
-        if (sd_state->pads)
-            sd_state->pads->try_fmt = *fmt;
-		#endif
+		*v4l2_subdev_state_get_format(sd_state, 0) = *fmt;
+		return 0;
+	}
 
-		mutex_unlock(&sensor->lock);
+	mutex_lock(&sensor->lock);
 
-		return 0;
+	/*
+	 * The receiver and the buffers are sized for the current format.
+	 * This includes the LP-11 window between pre_streamon and s_stream.
+	 */
+	if ((sensor->reset & AR1335_REG_RESET_STREAM) || sensor->lp11) {
+		mutex_unlock(&sensor->lock);
+		return -EBUSY;
 	}
-	idx = ar1335_try_mbus_fmt_locked(sd, &format->format);
+
+	/* Pixel processing follows the defaults of a newly selected mode */
+	mode_changed = idx != sensor->cur_res;
 	sensor->cur_res = idx;
+	/* The sensor must be armed again with the new mode */
+	sensor->armed = false;
+	sensor->lp11 = false;
+	sensor->fmt = *fmt;
+	sensor->skip = ar1335_res_table[idx].skip;
+	sensor->low_pll = ar1335_res_table[idx].low_pll;
+
+	/* Compute the PLL now so that stream on only has to program it */
 	ar1335_calc_pll(sensor);
-	sensor->fmt.width = format->format.width;
-	sensor->fmt.height = format->format.height;
-	sensor->fmt.field = V4L2_FIELD_NONE;
-	if (format->format.code == MEDIA_BUS_FMT_SRGGB10_1X10 ||
-	    format->format.code == MEDIA_BUS_FMT_SRGGB8_1X8) {
-		sensor->fmt.code = format->format.code;
-	} else {
-		dev_err(&client->dev, "%s %d format->format.code %d\n", __func__, __LINE__,
-			format->format.code);
-		return -EINVAL;
-	}
+	ret = ar1335_update_link_ctrls(sensor);
+	if (ret)
+		goto unlock;
 
 	/*
 	 * Update the exposure and blankings limits. Blankings are also reset
 	 * to the minimum.
 	 */
-	 // Calculate vblank and hblank values
-    	int vblank = FRAME_LENGTH_LINE_MAX - fmt->height;
-    	int hblank = LINE_LENGTH_PCK_MAX - fmt->width;
+	hblank = LINE_LENGTH_PCK_MAX - fmt->width;
 	max_hblank = AR1335_TOTAL_WIDTH_MAX - sensor->fmt.width;
 	ret = __v4l2_ctrl_modify_range(sensor->ctrls.hblank,
 				       sensor->ctrls.hblank->minimum,
@@ -545,6 +1599,13 @@ static int ar1335_set_fmt(struct v4l2_subdev *sd,
 	if (ret)
 		goto unlock;
 
+	/*
+	 * Aim for the mode rate, or the last requested one. The line time
+	 * follows the PLL, so the result never exceeds the link bandwidth.
+	 */
+	vblank = ar1335_fps_to_vblank(sensor, ar1335_res_table[idx].fps ?:
+					      sensor->req_fps);
+
 	max_vblank = AR1335_TOTAL_HEIGHT_MAX - sensor->fmt.height;
 	ret = __v4l2_ctrl_modify_range(sensor->ctrls.vblank,
 				       sensor->ctrls.vblank->minimum,
@@ -557,52 +1618,201 @@ static int ar1335_set_fmt(struct v4l2_subdev *sd,
 				 vblank);
 	if (ret)
 		goto unlock;
-	ret = __v4l2_ctrl_modify_range(sensor->ctrls.exposure,
-				       sensor->ctrls.exposure->minimum,
-				       EXPOSURE_MAX,
-				       sensor->ctrls.exposure->step,
-				       sensor->ctrls.exposure->default_value);
+	ar1335_update_frame_rate(sensor);
+	ret = ar1335_update_exposure_range(sensor);
+	if (ret)
+		goto unlock;
+
+	/* Keep user overrides while the mode stays the same */
+	if (mode_changed) {
+		ret = ar1335_set_mode_default(sensor->ctrls.defect_correction,
+				ar1335_res_table[idx].defect_correction);
+		if (ret)
+			goto unlock;
+
+		ret = ar1335_set_mode_default(sensor->ctrls.noise_correction,
+				ar1335_res_table[idx].noise_correction);
+		if (ret)
+			goto unlock;
+	}
+
+	*v4l2_subdev_state_get_format(sd_state, 0) = *fmt;
+
+	/*
+	 * Right after a stream stop extclk still runs. Program the new mode
+	 * now, so that switching out of motion watch only needs the stream
+	 * to be started again. The clock then stays on until stream on.
+	 */
+	if (sensor->extclk_on && ar1335_arm_stream(sensor))
+		dev_warn(sd->dev, "failed to arm the new mode\n");
 unlock:
+	ar1335_timing_add(&sensor->stats.set_fmt, start);
 	mutex_unlock(&sensor->lock);
 
 	return ret;
 }
 
+#define AR1335_TEST_PATTERN_WALKING_1S		4
+#define AR1335_TEST_PATTERN_EMBEDDED_DATA	5
+
 static u16 ar1335_test_pattern_values[] = {
-        0x0, // Normal pixel mode
-        0x1, // Solid color
-        0x2, // 100% color bar
-        0x3, // fade to gray color
-        0x100, // walking 1 (10bit)
-        0x101, // walking 1 (8bit)
+	0x0, /* Normal pixel mode */
+	0x1, /* Solid color */
+	0x2, /* 100% color bar */
+	0x3, /* fade to gray color */
+	0x100, /* walking 1 (10bit), 0x101 for 8bit */
+	0x2, /* 100% color bar, with embedded data lines */
 };
 
 static int ar1335_test_pattern(struct v4l2_subdev *sd, s32 val)
 {
-        struct ar1335_dev *sensor = to_ar1335_dev(sd);
-        return ar1335_write_reg(sensor, AR1335_REG_TEST_PATTERN_MODE,
-                                    ar1335_test_pattern_values[val]);
+	struct ar1335_dev *sensor = to_ar1335_dev(sd);
+	u16 mode = ar1335_test_pattern_values[val];
+	bool embedded = val == AR1335_TEST_PATTERN_EMBEDDED_DATA;
+	int ret;
+
+	/* Walking 1s must match the output bit depth */
+	if (val == AR1335_TEST_PATTERN_WALKING_1S &&
+	    ar1335_code_to_bpp(sensor) == 8)
+		mode = 0x101;
+
+	ret = ar1335_write_reg(sensor, AR1335_REG_TEST_PATTERN_MODE, mode);
+	if (ret)
+		return ret;
+
+	/*
+	 * The embedded data lines carry the register state of each frame,
+	 * including the frame count, next to a deterministic image. The
+	 * frame descriptor lists them so the receiver can capture them.
+	 */
+	return ar1335_update_reg(sensor, AR1335_REG_SMIA_TEST,
+				 AR1335_REG_SMIA_TEST_EMBEDDED_DATA,
+				 embedded ? AR1335_REG_SMIA_TEST_EMBEDDED_DATA : 0);
+}
+
+static int ar1335_set_test_data(struct ar1335_dev *sensor)
+{
+	__be16 regs[] = {
+		be(AR1335_REG_TEST_DATA_RED),
+		be(sensor->ctrls.test_data_red->val),
+		be(sensor->ctrls.test_data_greenr->val),
+		be(sensor->ctrls.test_data_blue->val),
+		be(sensor->ctrls.test_data_greenb->val),
+	};
+
+	return ar1335_write_regs(sensor, regs, ARRAY_SIZE(regs));
 }
 
+/* Convert programmed gain registers back to gain and balance values */
+static void ar1335_gains_to_ctrls(struct ar1335_dev *sensor, const u16 *gains)
+{
+	int green = (gains[0] >> 7) - 64 + (gains[0] & 0x7f);
+	int blue = (gains[1] >> 7) - 64 + (gains[1] & 0x7f);
+	int red = (gains[2] >> 7) - 64 + (gains[2] & 0x7f);
+
+	sensor->ctrls.programmed_gain->val = clamp(green, 0, 511);
+	sensor->ctrls.programmed_red_balance->val = red - green;
+	sensor->ctrls.programmed_blue_balance->val = blue - green;
+}
+
+/*
+ * Report what the sensor was actually given after anti-flicker rounding,
+ * frame stretching and gain clamping. Values come from the shadow copy,
+ * or from the sensor itself when readback is enabled in debugfs.
+ */
+static int ar1335_g_volatile_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct v4l2_subdev *sd = ctrl_to_sd(ctrl);
+	struct ar1335_dev *sensor = to_ar1335_dev(sd);
+	bool readback = sensor->readback && sensor->extclk_on;
+	u16 vals[ARRAY_SIZE(sensor->shadow.gains)];
+	int ret = 0;
+
+	switch (ctrl->id) {
+	case V4L2_CID_AR1335_PROGRAMMED_EXPOSURE:
+		if (readback) {
+			ret = ar1335_read_reg(sensor,
+					      AR1335_REG_COARSE_INTEGRATION_TIME,
+					      vals);
+			if (!ret)
+				ctrl->val = vals[0];
+		} else {
+			ctrl->val = sensor->shadow.exposure;
+		}
+		break;
+	case V4L2_CID_AR1335_PROGRAMMED_GAIN:
+		/* The master fills in the whole cluster */
+		if (readback) {
+			ret = ar1335_read_regs(sensor, AR1335_REG_GREEN1_GAIN,
+					       vals, ARRAY_SIZE(vals));
+			if (!ret)
+				ar1335_gains_to_ctrls(sensor, vals);
+		} else if (sensor->shadow.gains_set) {
+			ar1335_gains_to_ctrls(sensor, sensor->shadow.gains);
+		}
+		break;
+	case V4L2_CID_AR1335_FRAME_LENGTH:
+		if (readback) {
+			ret = ar1335_read_reg(sensor,
+					      AR1335_REG_FRAME_LENGTH_LINES,
+					      vals);
+			if (!ret)
+				ctrl->val = vals[0];
+		} else {
+			ctrl->val = sensor->frame_length;
+		}
+		break;
+	case V4L2_CID_AR1335_POWER_ESTIMATE:
+		ctrl->val = ar1335_power_estimate(sensor);
+		break;
+	case V4L2_CID_AR1335_TEMPERATURE:
+		/* Conversions only run while streaming */
+		ctrl->val = sensor->thermal.temp;
+		break;
+	}
+
+	return ret;
+}
 
 static int ar1335_s_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct v4l2_subdev *sd = ctrl_to_sd(ctrl);
 	struct ar1335_dev *sensor = to_ar1335_dev(sd);
-	int exp_max;
+	ktime_t start = ktime_get();
 	int ret;
 
 	/* v4l2_ctrl_lock() locks our own mutex */
 
 	switch (ctrl->id) {
-	case V4L2_CID_VBLANK:
-		exp_max = sensor->fmt.height + ctrl->val - 4;
-		__v4l2_ctrl_modify_range(sensor->ctrls.exposure,
-					 sensor->ctrls.exposure->minimum,
-					 exp_max, sensor->ctrls.exposure->step,
-					 sensor->ctrls.exposure->default_value);
+	case V4L2_CID_HBLANK:
+	case V4L2_CID_AR1335_AUTO_FRAME_RATE:
+	case V4L2_CID_AR1335_MIN_FRAME_RATE:
+		/* HBLANK is the cluster master, VBLANK may have changed too */
+		ar1335_update_exposure_range(sensor);
+		fallthrough;
+	case V4L2_CID_EXPOSURE:
+	case V4L2_CID_POWER_LINE_FREQUENCY:
+		/* These all set the frame length */
+		ar1335_update_frame_rate(sensor);
 		break;
+	case V4L2_CID_TEST_PATTERN:
+		/*
+		 * The receiver reads the frame descriptor, including the
+		 * embedded data entry, once at stream on.
+		 */
+		if ((sensor->reset & AR1335_REG_RESET_STREAM) &&
+		    (ctrl->val == AR1335_TEST_PATTERN_EMBEDDED_DATA) !=
+		    (ctrl->cur.val == AR1335_TEST_PATTERN_EMBEDDED_DATA))
+			return -EBUSY;
+		break;
+	}
+
+	/* Gated in standby, the next arm applies all controls */
+	if (!sensor->extclk_on) {
+		ar1335_timing_add(&sensor->stats.s_ctrl, start);
+		return 0;
 	}
+
 	switch (ctrl->id) {
 	case V4L2_CID_HBLANK:
 	case V4L2_CID_VBLANK:
@@ -618,33 +1828,307 @@ static int ar1335_s_ctrl(struct v4l2_ctrl *ctrl)
 		ret = ar1335_set_gains(sensor);
 		break;
 	case V4L2_CID_EXPOSURE:
-		ret = ar1335_write_reg(sensor,
-				       AR1335_REG_COARSE_INTEGRATION_TIME,
-				       ctrl->val);
+	case V4L2_CID_POWER_LINE_FREQUENCY:
+	case V4L2_CID_AR1335_AUTO_FRAME_RATE:
+	case V4L2_CID_AR1335_MIN_FRAME_RATE:
+		ret = ar1335_set_exposure(sensor);
 		break;
 	case V4L2_CID_TEST_PATTERN:
 		 ret = ar1335_test_pattern(&sensor->sd,ctrl->val);
 		break;
+	case V4L2_CID_TEST_PATTERN_RED:
+	case V4L2_CID_TEST_PATTERN_GREENR:
+	case V4L2_CID_TEST_PATTERN_BLUE:
+	case V4L2_CID_TEST_PATTERN_GREENB:
+		ret = ar1335_set_test_data(sensor);
+		break;
+	case V4L2_CID_AR1335_DEFECT_CORRECTION:
+		ret = ar1335_update_reg(sensor, AR1335_REG_PIX_DEF_ID,
+					AR1335_REG_PIX_DEF_ID_ENABLE,
+					ctrl->val ? AR1335_REG_PIX_DEF_ID_ENABLE : 0);
+		break;
+	case V4L2_CID_AR1335_NOISE_CORRECTION:
+		ret = ar1335_update_reg(sensor, AR1335_REG_COLUMN_CORRECTION,
+					AR1335_REG_COLUMN_CORRECTION_ENABLE,
+					ctrl->val ?
+					AR1335_REG_COLUMN_CORRECTION_ENABLE : 0);
+		break;
+	case V4L2_CID_AR1335_DATA_PEDESTAL:
+		ret = ar1335_write_reg(sensor, AR1335_REG_DATA_PEDESTAL,
+				       ctrl->val);
+		break;
+	case V4L2_CID_PIXEL_RATE:
+	case V4L2_CID_LINK_FREQ:
+		/* Read-only, follow the PLL set up by set_fmt */
+		ret = 0;
+		break;
+	case V4L2_CID_AR1335_SNAPSHOT_FRAMES:
+		/* Used at the next s_stream(1) */
+		ret = 0;
+		break;
+	case V4L2_CID_AR1335_THERMAL_THRESHOLD:
+	case V4L2_CID_AR1335_THERMAL_HYSTERESIS:
+		/* Used at the next thermal poll */
+		ret = 0;
+		break;
+	case V4L2_CID_AR1335_VIRTUAL_CHANNEL:
+		/* The receiver picked up the frame descriptor at stream on */
+		if (sensor->reset & AR1335_REG_RESET_STREAM) {
+			ret = -EBUSY;
+			break;
+		}
+		ret = ar1335_update_reg(sensor, AR1335_REG_MIPI_CNTRL,
+					AR1335_REG_MIPI_CNTRL_VC_MASK,
+					ctrl->val <<
+					AR1335_REG_MIPI_CNTRL_VC_SHIFT);
+		break;
 	default:
 		dev_err(&sensor->i2c_client->dev,
 			"Unsupported control %x\n", ctrl->id);
 		ret = -EINVAL;
 		break;
 	}
+
+	/*
+	 * Registers written during a frame latch at the next frame start,
+	 * the frame work reports when that frame arrives.
+	 */
+	if (!ret && ar1335_frame_events(sensor) && !sensor->ctrls_pending &&
+	    !ar1335_read_reg(sensor, AR1335_REG_FRAME_COUNT,
+			     &sensor->ctrls_frame)) {
+		sensor->ctrls_frame++;
+		sensor->ctrls_pending = true;
+	}
+
+	ar1335_timing_add(&sensor->stats.s_ctrl, start);
 	return ret;
 }
 
-static const struct v4l2_ctrl_ops ar1335_ctrl_ops = {
-	.s_ctrl = ar1335_s_ctrl,
+static const struct v4l2_ctrl_ops ar1335_ctrl_ops = {
+	.g_volatile_ctrl = ar1335_g_volatile_ctrl,
+	.s_ctrl = ar1335_s_ctrl,
+};
+
+static const char * const test_pattern_menu[] = {
+	"Normal pixel operation",
+	"Solid color",
+	"100% Color Bar",
+	"Fade-to-Gray Color Bars",
+	"Walking 1s",
+	"Color Bars + Embedded Data",
+};
+
+static const struct v4l2_ctrl_config ar1335_defect_correction_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_DEFECT_CORRECTION,
+	.name = "Defect Pixel Correction",
+	.type = V4L2_CTRL_TYPE_BOOLEAN,
+	.min = 0,
+	.max = 1,
+	.step = 1,
+	.def = 1,
+};
+
+static const struct v4l2_ctrl_config ar1335_noise_correction_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_NOISE_CORRECTION,
+	.name = "Column Noise Correction",
+	.type = V4L2_CTRL_TYPE_BOOLEAN,
+	.min = 0,
+	.max = 1,
+	.step = 1,
+	.def = 1,
+};
+
+/*
+ * The pedestal is added to all four colour channels after the on-chip black
+ * level calibration. The default is replaced by the value read back from the
+ * sensor once it has been initialised, see ar1335_init_pedestal().
+ */
+static const struct v4l2_ctrl_config ar1335_data_pedestal_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_DATA_PEDESTAL,
+	.name = "Data Pedestal",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = AR1335_DATA_PEDESTAL_MAX,
+	.step = 1,
+	.def = 0,
+};
+
+/*
+ * With auto frame rate the exposure range extends past the frame, and
+ * frame_length_lines grows with the exposure down to the minimum rate.
+ */
+static const struct v4l2_ctrl_config ar1335_auto_frame_rate_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_AUTO_FRAME_RATE,
+	.name = "Auto Frame Rate",
+	.type = V4L2_CTRL_TYPE_BOOLEAN,
+	.min = 0,
+	.max = 1,
+	.step = 1,
+	.def = 0,
+};
+
+static const struct v4l2_ctrl_config ar1335_min_frame_rate_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_MIN_FRAME_RATE,
+	.name = "Auto Frame Rate Minimum",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = AR1335_AFR_MIN_FRAME_RATE,
+	.max = MAX_FRAME_RATE,
+	.step = 1,
+	.def = AR1335_AFR_DEF_FRAME_RATE,
+};
+
+/*
+ * Number of frames s_stream(1) captures before the sensor drops back to
+ * standby on its own, 0 streams continuously.
+ */
+static const struct v4l2_ctrl_config ar1335_snapshot_frames_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_SNAPSHOT_FRAMES,
+	.name = "Snapshot Frames",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = AR1335_SNAPSHOT_FRAMES_MAX,
+	.step = 1,
+	.def = 0,
+};
+
+/*
+ * CSI-2 virtual channel of the image and embedded data, the default comes
+ * from the DT "onnn,virtual-channel" property.
+ */
+static const struct v4l2_ctrl_config ar1335_virtual_channel_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_VIRTUAL_CHANNEL,
+	.name = "Virtual Channel",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = AR1335_VIRTUAL_CHANNEL_MAX,
+	.step = 1,
+	.def = 0,
 };
 
-static const char * const test_pattern_menu[] = {
-	"Normal pixel operation",
-	"Solid color",
-	"100% Color Bar",
-	"Fade-to-Gray Color Bars",
-	"Walking 1s (10-bit)",
-	"Walking 1s (8-bit)",
+/*
+ * frame_length_lines as programmed, including stretching by auto frame
+ * rate and anti-flicker that VBLANK does not show.
+ */
+static const struct v4l2_ctrl_config ar1335_frame_length_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_FRAME_LENGTH,
+	.name = "Frame Length Lines",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = 0,
+	.max = AR1335_TOTAL_HEIGHT_MAX,
+	.step = 1,
+	.def = 0,
+};
+
+/*
+ * Exposure and gains as last written to the sensor, after anti-flicker
+ * rounding and clamping. EXPOSURE and GAIN keep the requested values.
+ */
+static const struct v4l2_ctrl_config ar1335_programmed_exposure_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_PROGRAMMED_EXPOSURE,
+	.name = "Programmed Exposure",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = 0,
+	/* Frame stretching lets it go past the EXPOSURE range */
+	.max = AR1335_TOTAL_HEIGHT_MAX - AR1335_EXPOSURE_MARGIN,
+	.step = 1,
+	.def = 0,
+};
+
+static const struct v4l2_ctrl_config ar1335_programmed_gain_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_PROGRAMMED_GAIN,
+	.name = "Programmed Gain",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = 0,
+	.max = 511,
+	.step = 1,
+	.def = 0,
+};
+
+static const struct v4l2_ctrl_config ar1335_programmed_red_balance_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_PROGRAMMED_RED_BALANCE,
+	.name = "Programmed Red Balance",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = -512,
+	.max = 511,
+	.step = 1,
+	.def = 0,
+};
+
+static const struct v4l2_ctrl_config ar1335_programmed_blue_balance_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_PROGRAMMED_BLUE_BALANCE,
+	.name = "Programmed Blue Balance",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = -512,
+	.max = 511,
+	.step = 1,
+	.def = 0,
+};
+
+/* Estimated sensor power for the current mode and state, in uW */
+static const struct v4l2_ctrl_config ar1335_power_estimate_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_POWER_ESTIMATE,
+	.name = "Power Estimate (uW)",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = 0,
+	.max = AR1335_POWER_MAX_UW,
+	.step = 1,
+	.def = 0,
+};
+
+/* Last reading of the on-chip temperature sensor, in C */
+static const struct v4l2_ctrl_config ar1335_temperature_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_TEMPERATURE,
+	.name = "Temperature (C)",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.flags = V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_VOLATILE,
+	.min = -128,
+	.max = 127,
+	.step = 1,
+	.def = 0,
+};
+
+/* Temperature at which the frame rate is stepped down */
+static const struct v4l2_ctrl_config ar1335_thermal_threshold_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_THERMAL_THRESHOLD,
+	.name = "Thermal Throttle Temperature",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = AR1335_THERMAL_TEMP_MIN,
+	.max = AR1335_THERMAL_TEMP_MAX,
+	.step = 1,
+	.def = AR1335_THERMAL_TEMP_DEF,
+};
+
+/* Drop below the threshold needed to step the frame rate back up */
+static const struct v4l2_ctrl_config ar1335_thermal_hysteresis_ctrl = {
+	.ops = &ar1335_ctrl_ops,
+	.id = V4L2_CID_AR1335_THERMAL_HYSTERESIS,
+	.name = "Thermal Throttle Hysteresis",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 1,
+	.max = AR1335_THERMAL_HYST_MAX,
+	.step = 1,
+	.def = AR1335_THERMAL_HYST_DEF,
 };
 
 static int ar1335_init_controls(struct ar1335_dev *sensor)
@@ -652,8 +2136,9 @@ static int ar1335_init_controls(struct ar1335_dev *sensor)
 	const struct v4l2_ctrl_ops *ops = &ar1335_ctrl_ops;
 	struct ar1335_ctrls *ctrls = &sensor->ctrls;
 	struct v4l2_ctrl_handler *hdl = &ctrls->handler;
+	struct v4l2_ctrl_config vc_ctrl = ar1335_virtual_channel_ctrl;
 	int max_vblank, max_hblank;
-	struct v4l2_ctrl *link_freq;
+	unsigned int i;
 	int ret;
 
 	v4l2_ctrl_handler_init(hdl, 32);
@@ -689,24 +2174,89 @@ static int ar1335_init_controls(struct ar1335_dev *sensor)
 	v4l2_ctrl_cluster(2, &ctrls->hblank);
 
 	/* Read-only */
-	ctrls->pixrate = v4l2_ctrl_new_std(hdl, ops, V4L2_CID_PIXEL_RATE,
-					   AR1335_PIXEL_CLOCK_MIN,
-					   AR1335_PIXEL_CLOCK_MAX, 1,
-					   AR1335_PIXEL_CLOCK_RATE);
+	ctrls->pixrate = v4l2_ctrl_new_std(hdl, ops, V4L2_CID_PIXEL_RATE, 1,
+					   AR1335_PIXEL_CLOCK_RATE *
+					   AR1335_PIXELS_PER_CLOCK, 1,
+					   AR1335_PIXEL_CLOCK_RATE *
+					   AR1335_PIXELS_PER_CLOCK);
 	ctrls->exposure = v4l2_ctrl_new_std(hdl, ops, V4L2_CID_EXPOSURE, 0,
 					    EXPOSURE_MAX, 1, 0xC2E);
-
-	link_freq = v4l2_ctrl_new_int_menu(hdl, ops, V4L2_CID_LINK_FREQ,
-					ARRAY_SIZE(ar1335_link_frequencies) - 1,
-					0, ar1335_link_frequencies);
-	if (link_freq)
-		link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
+	ctrls->power_line_freq = v4l2_ctrl_new_std_menu(hdl, ops,
+					V4L2_CID_POWER_LINE_FREQUENCY,
+					V4L2_CID_POWER_LINE_FREQUENCY_60HZ, 0,
+					V4L2_CID_POWER_LINE_FREQUENCY_DISABLED);
+	ctrls->auto_frame_rate = v4l2_ctrl_new_custom(hdl,
+					&ar1335_auto_frame_rate_ctrl, NULL);
+	ctrls->min_frame_rate = v4l2_ctrl_new_custom(hdl,
+					&ar1335_min_frame_rate_ctrl, NULL);
+	ctrls->snapshot_frames = v4l2_ctrl_new_custom(hdl,
+					&ar1335_snapshot_frames_ctrl, NULL);
+	vc_ctrl.def = sensor->virtual_channel;
+	ctrls->virtual_channel = v4l2_ctrl_new_custom(hdl, &vc_ctrl, NULL);
+	ctrls->frame_length = v4l2_ctrl_new_custom(hdl,
+					&ar1335_frame_length_ctrl, NULL);
+	ctrls->programmed_exposure = v4l2_ctrl_new_custom(hdl,
+					&ar1335_programmed_exposure_ctrl, NULL);
+	ctrls->programmed_gain = v4l2_ctrl_new_custom(hdl,
+					&ar1335_programmed_gain_ctrl, NULL);
+	ctrls->programmed_red_balance = v4l2_ctrl_new_custom(hdl,
+					&ar1335_programmed_red_balance_ctrl, NULL);
+	ctrls->programmed_blue_balance = v4l2_ctrl_new_custom(hdl,
+					&ar1335_programmed_blue_balance_ctrl, NULL);
+	v4l2_ctrl_cluster(3, &ctrls->programmed_gain);
+	ctrls->power_estimate = v4l2_ctrl_new_custom(hdl,
+					&ar1335_power_estimate_ctrl, NULL);
+	ctrls->temperature = v4l2_ctrl_new_custom(hdl,
+					&ar1335_temperature_ctrl, NULL);
+	ctrls->thermal_threshold = v4l2_ctrl_new_custom(hdl,
+					&ar1335_thermal_threshold_ctrl, NULL);
+	ctrls->thermal_hysteresis = v4l2_ctrl_new_custom(hdl,
+					&ar1335_thermal_hysteresis_ctrl, NULL);
+
+	/* Two entries per media bus code, selected by set_fmt */
+	for (i = 0; i < ARRAY_SIZE(sensor->link_freqs); i++) {
+		unsigned int n = i % ARRAY_SIZE(ar1335_mbus_codes);
+
+		sensor->link_freqs[i] = ar1335_link_freq(sensor,
+				ar1335_mbus_code_bpp(ar1335_mbus_codes[n]),
+				i >= ARRAY_SIZE(ar1335_mbus_codes));
+	}
+	ctrls->link_freq = v4l2_ctrl_new_int_menu(hdl, ops, V4L2_CID_LINK_FREQ,
+					ARRAY_SIZE(sensor->link_freqs) - 1,
+					0, sensor->link_freqs);
+	if (ctrls->link_freq)
+		ctrls->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
 
 	ctrls->test_pattern = v4l2_ctrl_new_std_menu_items(hdl, ops,
 					V4L2_CID_TEST_PATTERN,
 					ARRAY_SIZE(test_pattern_menu) - 1,
 					0, 0, test_pattern_menu);
 
+	/* Solid color test pattern data */
+	ctrls->test_data_red = v4l2_ctrl_new_std(hdl, ops,
+					V4L2_CID_TEST_PATTERN_RED, 0,
+					AR1335_TEST_DATA_MAX, 1, 0);
+	ctrls->test_data_greenr = v4l2_ctrl_new_std(hdl, ops,
+					V4L2_CID_TEST_PATTERN_GREENR, 0,
+					AR1335_TEST_DATA_MAX, 1, 0);
+	ctrls->test_data_blue = v4l2_ctrl_new_std(hdl, ops,
+					V4L2_CID_TEST_PATTERN_BLUE, 0,
+					AR1335_TEST_DATA_MAX, 1, 0);
+	ctrls->test_data_greenb = v4l2_ctrl_new_std(hdl, ops,
+					V4L2_CID_TEST_PATTERN_GREENB, 0,
+					AR1335_TEST_DATA_MAX, 1, 0);
+	v4l2_ctrl_cluster(4, &ctrls->test_data_red);
+
+	/* On-sensor pixel processing */
+	ctrls->defect_correction = v4l2_ctrl_new_custom(hdl,
+					&ar1335_defect_correction_ctrl, NULL);
+	ctrls->noise_correction = v4l2_ctrl_new_custom(hdl,
+					&ar1335_noise_correction_ctrl, NULL);
+
+	/* Black level */
+	ctrls->data_pedestal = v4l2_ctrl_new_custom(hdl,
+					&ar1335_data_pedestal_ctrl, NULL);
+
 	if (hdl->error) {
 		ret = hdl->error;
 		goto free_ctrls;
@@ -720,41 +2270,38 @@ free_ctrls:
 	return ret;
 }
 
-#define REGS_ENTRY(a)	{(a), ARRAY_SIZE(a)}
-#define REGS(...)	REGS_ENTRY(((const __be16[]){__VA_ARGS__}))
-
-static const struct initial_reg {
-	const __be16 *data; /* data[0] is register address */
-	unsigned int count;
-} initial_regs[] = {
-	REGS(be(0x301A),be(0x0210)),               
-	REGS(be(0x3EB6),be(0x004D)), 
-	REGS(be(0x3EBC),be(0xAA06)),
-	REGS(be(0x3EC0),be(0x1E02)),
-	REGS(be(0x3EC2),be(0x7700)),
-	REGS(be(0x3EC4),be(0x1C08)),
-	REGS(be(0x3EC6),be(0xEA44)),
-	REGS(be(0x3EC8),be(0x0F0F)),
-	REGS(be(0x3ECA),be(0x0F4A)),
-	REGS(be(0x3ECC),be(0x0706)),
-	REGS(be(0x3ECE),be(0x443B)),
-	REGS(be(0x3ED0),be(0x12F0)),
-	REGS(be(0x3ED2),be(0x0039)),
-	REGS(be(0x3ED4),be(0x862F)),
-	REGS(be(0x3ED6),be(0x4080)),
-	REGS(be(0x3ED8),be(0x0523)),
-	REGS(be(0x3EDA),be(0xF896)),
-	REGS(be(0x3EDC),be(0x508C)),
-	REGS(be(0x3EDE),be(0x5005)),
-	REGS(be(0x316A),be(0x8200)),
-	REGS(be(0x316E),be(0x8200)),
-	REGS(be(0x316C),be(0x8200)),
-	REGS(be(0x3EF0),be(0x414D)),
-	REGS(be(0x3EF2),be(0x0101)),
-	REGS(be(0x3EF6),be(0x0307)),
-	REGS(be(0x3EFA),be(0x0F0F)),
-	REGS(be(0x3EFC),be(0x0F0F)),
-	REGS(be(0x3EFE),be(0x0F0F)),
+/*
+ * Packed run-length encoding: each run is a header holding the number of
+ * values, followed by the start register address and the values, all BE16.
+ * Address and values are laid out exactly as ar1335_write_regs() expects,
+ * so every run is sent straight from .rodata as a single burst.
+ */
+#define REGS(...)	be(ARRAY_SIZE(((const __be16[]){__VA_ARGS__})) - 1), \
+			__VA_ARGS__
+
+/*
+ * Sensor and sequencer setup, identical for every AR1335 in the system and
+ * therefore kept in a single read-only table. Contiguous registers are
+ * merged into bursts of at most 32 values. Registers depending on the board
+ * configuration are kept per device, see ar1335_init_lane_regs().
+ */
+static const __be16 initial_regs[] = {
+	REGS(be(0x301A), be(0x0210)),
+	REGS(be(0x3EB6), be(0x004D)),
+	REGS(be(0x3EBC), be(0xAA06)),
+	REGS(be(0x3EC0),
+	     /* 3EC0 */ be(0x1E02), be(0x7700), be(0x1C08), be(0xEA44),
+	     /* 3EC8 */ be(0x0F0F), be(0x0F4A), be(0x0706), be(0x443B),
+	     /* 3ED0 */ be(0x12F0), be(0x0039), be(0x862F), be(0x4080),
+	     /* 3ED8 */ be(0x0523), be(0xF896), be(0x508C), be(0x5005)),
+	REGS(be(0x316A), be(0x8200)),
+	REGS(be(0x316E), be(0x8200)),
+	REGS(be(0x316C), be(0x8200)),
+	REGS(be(0x3EF0),
+	     /* 3EF0 */ be(0x414D), be(0x0101)),
+	REGS(be(0x3EF6), be(0x0307)),
+	REGS(be(0x3EFA),
+	     /* 3EFA */ be(0x0F0F), be(0x0F0F), be(0x0F0F)),
 	REGS(be(0x3172), be(0x0206)), /* txlo clk divider options */
 	REGS(be(0x3040), be(0x4041)),
 	REGS(be(0x317A), be(0x416E)),
@@ -771,243 +2318,119 @@ static const struct initial_reg {
 	     be(0x068B)),
 	/* don't use continuous clock mode while shut down */
 	//REGS(be(0x31BC), be(0x068B)),
-	REGS(be(0x0112), be(0x0A0A)), /* 10-bit/10-bit mode */
-	REGS(be(0x3D00),be(0x0446)),
-	REGS(be(0x3D02),be(0x4C66)),
-	REGS(be(0x3D04),be(0xFFFF)),
-	REGS(be(0x3D06),be(0xFFFF)),
-	REGS(be(0x3D08),be(0x5E40)),
-	REGS(be(0x3D0A),be(0x1146)),
-	REGS(be(0x3D0C),be(0x5D41)),
-	REGS(be(0x3D0E),be(0x1088)),
-	REGS(be(0x3D10),be(0x8342)),
-	REGS(be(0x3D12),be(0x00C0)),
-	REGS(be(0x3D14),be(0x5580)),
-	REGS(be(0x3D16),be(0x5B83)),
-	REGS(be(0x3D18),be(0x6084)),
-	REGS(be(0x3D1A),be(0x5A8D)),
-	REGS(be(0x3D1C),be(0x00C0)),
-	REGS(be(0x3D1E),be(0x8342)),
-	REGS(be(0x3D20),be(0x925A)),
-	REGS(be(0x3D22),be(0x8664)),
-	REGS(be(0x3D24),be(0x1030)),
-	REGS(be(0x3D26),be(0x801C)),
-	REGS(be(0x3D28),be(0x00A0)),
-	REGS(be(0x3D2A),be(0x56B0)),
-	REGS(be(0x3D2C),be(0x5788)),
-	REGS(be(0x3D2E),be(0x5150)),
-	REGS(be(0x3D30),be(0x824D)),
-	REGS(be(0x3D32),be(0x8D58)),
-	REGS(be(0x3D34),be(0x58D2)),
-	REGS(be(0x3D36),be(0x438A)),
-	REGS(be(0x3D38),be(0x4592)),
-	REGS(be(0x3D3A),be(0x458A)),
-	REGS(be(0x3D3C),be(0x4389)),
-	REGS(be(0x3D3E),be(0x51FF)),
-	REGS(be(0x3D40),be(0x8451)),
-	REGS(be(0x3D42),be(0x8410)),
-	REGS(be(0x3D44),be(0x0C88)),
-	REGS(be(0x3D46),be(0x5959)),
-	REGS(be(0x3D48),be(0x8A5F)),
-	REGS(be(0x3D4A),be(0xDA42)),
-	REGS(be(0x3D4C),be(0x9361)),
-	REGS(be(0x3D4E),be(0X8262)),
-	REGS(be(0x3D50),be(0x8342)),
-	REGS(be(0x3D52),be(0x8010)),
-	REGS(be(0x3D54),be(0xC041)),
-	REGS(be(0x3D56),be(0x64FF)),
-	REGS(be(0x3D58),be(0xFFB7)),
-	REGS(be(0x3D5A),be(0x4081)),
-	REGS(be(0x3D5C),be(0x4080)),
-	REGS(be(0x3D5E),be(0x4180)),
-	REGS(be(0x3D60),be(0x4280)),
-	REGS(be(0x3D62),be(0x438D)),
-	REGS(be(0x3D64),be(0x44BA)),
-	REGS(be(0x3D66),be(0x4488)),
-	REGS(be(0x3D68),be(0x4380)),
-	REGS(be(0x3D6A),be(0x4241)),
-	REGS(be(0x3D6C),be(0x8140)),
-	REGS(be(0x3D6E),be(0x8240)),
-	REGS(be(0x3D70),be(0x8041)),
-	REGS(be(0x3D72),be(0x8042)),
-	REGS(be(0x3D74),be(0x8043)),
-	REGS(be(0x3D76),be(0x8D44)),
-	REGS(be(0x3D78),be(0xBA44)),
-	REGS(be(0x3D7A),be(0x875E)),
-	REGS(be(0x3D7C),be(0x4354)),
-	REGS(be(0x3D7E),be(0x4241)),
-	REGS(be(0x3D80),be(0x8140)),
-	REGS(be(0x3D82),be(0x8120)),
-	REGS(be(0x3D84),be(0x2881)),
-	REGS(be(0x3D86),be(0x6026)),
-	REGS(be(0x3D88),be(0x8055)),
-	REGS(be(0x3D8A),be(0x8070)),
-	REGS(be(0x3D8C),be(0x8040)),
-	REGS(be(0x3D8E),be(0x4C81)),
-	REGS(be(0x3D90),be(0x45C3)),
-	REGS(be(0x3D92),be(0x4581)),
-	REGS(be(0x3D94),be(0x4C40)),
-	REGS(be(0x3D96),be(0x8070)),
-	REGS(be(0x3D98),be(0x8040)),
-	REGS(be(0x3D9A),be(0x4C85)),
-	REGS(be(0x3D9C),be(0x6CA8)),
-	REGS(be(0x3D9E),be(0x6C8C)),
-	REGS(be(0x3DA0),be(0x000E)),
-	REGS(be(0x3DA2),be(0xBE44)),
-	REGS(be(0x3DA4),be(0x8844)),
-	REGS(be(0x3DA6),be(0xBC78)),
-	REGS(be(0x3DA8),be(0x0900)),
-	REGS(be(0x3DAA),be(0x8904)),
-	REGS(be(0x3DAC),be(0x8080)),
-	REGS(be(0x3DAE),be(0x0240)),
-	REGS(be(0x3DB0),be(0x8609)),
-	REGS(be(0x3DB2),be(0x008E)),
-	REGS(be(0x3DB4),be(0x0900)),
-	REGS(be(0x3DB6),be(0x8002)),
-	REGS(be(0x3DB8),be(0x4080)),
-	REGS(be(0x3DBA),be(0x0480)),
-	REGS(be(0x3DBC),be(0x887C)),
-	REGS(be(0x3DBE),be(0xAA86)),
-	REGS(be(0x3DC0),be(0x0900)),
-	REGS(be(0x3DC2),be(0x877A)),
-	REGS(be(0x3DC4),be(0x000E)),
-	REGS(be(0x3DC6),be(0xC379)),
-	REGS(be(0x3DC8),be(0x4C40)),
-	REGS(be(0x3DCA),be(0xBF70)),
-	REGS(be(0x3DCC),be(0x5E40)),
-	REGS(be(0x3DCE),be(0x114E)),
-	REGS(be(0x3DD0),be(0x5D41)),
-	REGS(be(0x3DD2),be(0x5383)),
-	REGS(be(0x3DD4),be(0x4200)),
-	REGS(be(0x3DD6),be(0xC055)),
-	REGS(be(0x3DD8),be(0xA400)),
-	REGS(be(0x3DDA),be(0xC083)),
-	REGS(be(0x3DDC),be(0x4288)),
-	REGS(be(0x3DDE),be(0x6083)),
-	REGS(be(0x3DE0),be(0x5B80)),
-	REGS(be(0x3DE2),be(0x5A64)),
-	REGS(be(0x3DE4),be(0x1030)),
-	REGS(be(0x3DE6),be(0x801C)),
-	REGS(be(0x3DE8),be(0x00A5)),
-	REGS(be(0x3DEA),be(0x5697)),
-	REGS(be(0x3DEC),be(0x57A5)),
-	REGS(be(0x3DEE),be(0x5180)),
-	REGS(be(0x3DF0),be(0x505A)),
-	REGS(be(0x3DF2),be(0x814D)),
-	REGS(be(0x3DF4),be(0x8358)),
-	REGS(be(0x3DF6),be(0x8058)),
-	REGS(be(0x3DF8),be(0xA943)),
-	REGS(be(0x3DFA),be(0x8345)),
-	REGS(be(0x3DFC),be(0xB045)),
-	REGS(be(0x3DFE),be(0x8343)),
-	REGS(be(0x3E00),be(0xA351)),
-	REGS(be(0x3E02),be(0xE251)),
-	REGS(be(0x3E04),be(0x8C59)),
-	REGS(be(0x3E06),be(0x8059)),
-	REGS(be(0x3E08),be(0x8A5F)),
-	REGS(be(0x3E0A),be(0xEC7C)),
-	REGS(be(0x3E0C),be(0xCC84)),
-	REGS(be(0x3E0E),be(0x6182)),
-	REGS(be(0x3E10),be(0x6283)),
-	REGS(be(0x3E12),be(0x4283)),
-	REGS(be(0x3E14),be(0x10CC)),
-	REGS(be(0x3E16),be(0x6496)),
-	REGS(be(0x3E18),be(0x4281)),
-	REGS(be(0x3E1A),be(0x41BB)),
-	REGS(be(0x3E1C),be(0x4082)),
-	REGS(be(0x3E1E),be(0x407E)),
-	REGS(be(0x3E20),be(0xCC41)),
-	REGS(be(0x3E22),be(0x8042)),
-	REGS(be(0x3E24),be(0x8043)),
-	REGS(be(0x3E26),be(0x8300)),
-	REGS(be(0x3E28),be(0xC088)),
-	REGS(be(0x3E2A),be(0x44BA)),
-	REGS(be(0x3E2C),be(0x4488)),
-	REGS(be(0x3E2E),be(0x00C8)),
-	REGS(be(0x3E30),be(0x8042)),
-	REGS(be(0x3E32),be(0x4181)),
-	REGS(be(0x3E34),be(0x4082)),
-	REGS(be(0x3E36),be(0x4080)),
-	REGS(be(0x3E38),be(0x4180)),
-	REGS(be(0x3E3A),be(0x4280)),
-	REGS(be(0x3E3C),be(0x4383)),
-	REGS(be(0x3E3E),be(0x00C0)),
-	REGS(be(0x3E40),be(0x8844)),
-	REGS(be(0x3E42),be(0xBA44)),
-	REGS(be(0x3E44),be(0x8800)),
-	REGS(be(0x3E46),be(0xC880)),
-	REGS(be(0x3E48),be(0x4241)),
-	REGS(be(0x3E4A),be(0x8240)),
-	REGS(be(0x3E4C),be(0x8140)),
-	REGS(be(0x3E4E),be(0x8041)),
-	REGS(be(0x3E50),be(0x8042)),
-	REGS(be(0x3E52),be(0x8043)),
-	REGS(be(0x3E54),be(0x8300)),
-	REGS(be(0x3E56),be(0xC088)),
-	REGS(be(0x3E58),be(0x44BA)),
-	REGS(be(0x3E5A),be(0x4488)),
-	REGS(be(0x3E5C),be(0x00C8)),
-	REGS(be(0x3E5E),be(0x8042)),
-	REGS(be(0x3E60),be(0x4181)),
-	REGS(be(0x3E62),be(0x4082)),
-	REGS(be(0x3E64),be(0x4080)),
-	REGS(be(0x3E66),be(0x4180)),
-	REGS(be(0x3E68),be(0x4280)),
-	REGS(be(0x3E6A),be(0x4383)),
-	REGS(be(0x3E6C),be(0x00C0)),
-	REGS(be(0x3E6E),be(0x8844)),
-	REGS(be(0x3E70),be(0xBA44)),
-	REGS(be(0x3E72),be(0x8800)),
-	REGS(be(0x3E74),be(0xC880)),
-	REGS(be(0x3E76),be(0x4241)),
-	REGS(be(0x3E78),be(0x8140)),
-	REGS(be(0x3E7A),be(0x9F5E)),
-	REGS(be(0x3E7C),be(0x8A54)),
-	REGS(be(0x3E7E),be(0x8620)),
-	REGS(be(0x3E80),be(0x2881)),
-	REGS(be(0x3E82),be(0x6026)),
-	REGS(be(0x3E84),be(0x8055)),
-	REGS(be(0x3E86),be(0x8070)),
-	REGS(be(0x3E88),be(0x0000)),
-	REGS(be(0x3E8A),be(0x0000)),
-	REGS(be(0x3E8C),be(0x0000)),
-	REGS(be(0x3E8E),be(0x0000)),
-	REGS(be(0x3E90),be(0x0000)),
-	REGS(be(0x3E92),be(0x0000)),
-	REGS(be(0x3E94),be(0x0000)),
-	REGS(be(0x3E96),be(0x0000)),
-	REGS(be(0x3E98),be(0x0000)),
-	REGS(be(0x3E9A),be(0x0000)),
-	REGS(be(0x3E9C),be(0x0000)),
-	REGS(be(0x3E9E),be(0x0000)),
-	REGS(be(0x3EA0),be(0x0000)),
-	REGS(be(0x3EA2),be(0x0000)),
-	REGS(be(0x3EA4),be(0x0000)),
-	REGS(be(0x3EA6),be(0x0000)),
-	REGS(be(0x3EA8),be(0x0000)),
-	REGS(be(0x3EAA),be(0x0000)),
-	REGS(be(0x3EAC),be(0x0000)),
-	REGS(be(0x3EAE),be(0x0000)),
-	REGS(be(0x3EB0),be(0x0000)),
-	REGS(be(0x3EB2),be(0x0000)),
-	REGS(be(0x3EB4),be(0x0000)),
+	REGS(be(0x0112), be(0x0A0A)), /* 10-bit, see ar1335_arm_stream() */
+	REGS(be(0x3D00),
+	     /* 3D00 */ be(0x0446), be(0x4C66), be(0xFFFF), be(0xFFFF),
+	     /* 3D08 */ be(0x5E40), be(0x1146), be(0x5D41), be(0x1088),
+	     /* 3D10 */ be(0x8342), be(0x00C0), be(0x5580), be(0x5B83),
+	     /* 3D18 */ be(0x6084), be(0x5A8D), be(0x00C0), be(0x8342),
+	     /* 3D20 */ be(0x925A), be(0x8664), be(0x1030), be(0x801C),
+	     /* 3D28 */ be(0x00A0), be(0x56B0), be(0x5788), be(0x5150),
+	     /* 3D30 */ be(0x824D), be(0x8D58), be(0x58D2), be(0x438A),
+	     /* 3D38 */ be(0x4592), be(0x458A), be(0x4389), be(0x51FF)),
+	REGS(be(0x3D40),
+	     /* 3D40 */ be(0x8451), be(0x8410), be(0x0C88), be(0x5959),
+	     /* 3D48 */ be(0x8A5F), be(0xDA42), be(0x9361), be(0x8262),
+	     /* 3D50 */ be(0x8342), be(0x8010), be(0xC041), be(0x64FF),
+	     /* 3D58 */ be(0xFFB7), be(0x4081), be(0x4080), be(0x4180),
+	     /* 3D60 */ be(0x4280), be(0x438D), be(0x44BA), be(0x4488),
+	     /* 3D68 */ be(0x4380), be(0x4241), be(0x8140), be(0x8240),
+	     /* 3D70 */ be(0x8041), be(0x8042), be(0x8043), be(0x8D44),
+	     /* 3D78 */ be(0xBA44), be(0x875E), be(0x4354), be(0x4241)),
+	REGS(be(0x3D80),
+	     /* 3D80 */ be(0x8140), be(0x8120), be(0x2881), be(0x6026),
+	     /* 3D88 */ be(0x8055), be(0x8070), be(0x8040), be(0x4C81),
+	     /* 3D90 */ be(0x45C3), be(0x4581), be(0x4C40), be(0x8070),
+	     /* 3D98 */ be(0x8040), be(0x4C85), be(0x6CA8), be(0x6C8C),
+	     /* 3DA0 */ be(0x000E), be(0xBE44), be(0x8844), be(0xBC78),
+	     /* 3DA8 */ be(0x0900), be(0x8904), be(0x8080), be(0x0240),
+	     /* 3DB0 */ be(0x8609), be(0x008E), be(0x0900), be(0x8002),
+	     /* 3DB8 */ be(0x4080), be(0x0480), be(0x887C), be(0xAA86)),
+	REGS(be(0x3DC0),
+	     /* 3DC0 */ be(0x0900), be(0x877A), be(0x000E), be(0xC379),
+	     /* 3DC8 */ be(0x4C40), be(0xBF70), be(0x5E40), be(0x114E),
+	     /* 3DD0 */ be(0x5D41), be(0x5383), be(0x4200), be(0xC055),
+	     /* 3DD8 */ be(0xA400), be(0xC083), be(0x4288), be(0x6083),
+	     /* 3DE0 */ be(0x5B80), be(0x5A64), be(0x1030), be(0x801C),
+	     /* 3DE8 */ be(0x00A5), be(0x5697), be(0x57A5), be(0x5180),
+	     /* 3DF0 */ be(0x505A), be(0x814D), be(0x8358), be(0x8058),
+	     /* 3DF8 */ be(0xA943), be(0x8345), be(0xB045), be(0x8343)),
+	REGS(be(0x3E00),
+	     /* 3E00 */ be(0xA351), be(0xE251), be(0x8C59), be(0x8059),
+	     /* 3E08 */ be(0x8A5F), be(0xEC7C), be(0xCC84), be(0x6182),
+	     /* 3E10 */ be(0x6283), be(0x4283), be(0x10CC), be(0x6496),
+	     /* 3E18 */ be(0x4281), be(0x41BB), be(0x4082), be(0x407E),
+	     /* 3E20 */ be(0xCC41), be(0x8042), be(0x8043), be(0x8300),
+	     /* 3E28 */ be(0xC088), be(0x44BA), be(0x4488), be(0x00C8),
+	     /* 3E30 */ be(0x8042), be(0x4181), be(0x4082), be(0x4080),
+	     /* 3E38 */ be(0x4180), be(0x4280), be(0x4383), be(0x00C0)),
+	REGS(be(0x3E40),
+	     /* 3E40 */ be(0x8844), be(0xBA44), be(0x8800), be(0xC880),
+	     /* 3E48 */ be(0x4241), be(0x8240), be(0x8140), be(0x8041),
+	     /* 3E50 */ be(0x8042), be(0x8043), be(0x8300), be(0xC088),
+	     /* 3E58 */ be(0x44BA), be(0x4488), be(0x00C8), be(0x8042),
+	     /* 3E60 */ be(0x4181), be(0x4082), be(0x4080), be(0x4180),
+	     /* 3E68 */ be(0x4280), be(0x4383), be(0x00C0), be(0x8844),
+	     /* 3E70 */ be(0xBA44), be(0x8800), be(0xC880), be(0x4241),
+	     /* 3E78 */ be(0x8140), be(0x9F5E), be(0x8A54), be(0x8620)),
+	REGS(be(0x3E80),
+	     /* 3E80 */ be(0x2881), be(0x6026), be(0x8055), be(0x8070),
+	     /* 3E88 */ be(0x0000), be(0x0000), be(0x0000), be(0x0000),
+	     /* 3E90 */ be(0x0000), be(0x0000), be(0x0000), be(0x0000),
+	     /* 3E98 */ be(0x0000), be(0x0000), be(0x0000), be(0x0000),
+	     /* 3EA0 */ be(0x0000), be(0x0000), be(0x0000), be(0x0000),
+	     /* 3EA8 */ be(0x0000), be(0x0000), be(0x0000), be(0x0000),
+	     /* 3EB0 */ be(0x0000), be(0x0000), be(0x0000)),
 };
 
+/* Upload a table in the packed REGS() encoding, one burst per run */
+static int ar1335_write_seq(struct ar1335_dev *sensor, const __be16 *seq,
+			    unsigned int len)
+{
+	const __be16 *end = seq + len;
+	int ret;
+
+	while (seq < end) {
+		/* Address plus values */
+		unsigned int count = be16_to_cpu(*seq++) + 1;
+
+		ret = ar1335_write_regs(sensor, seq, count);
+		if (ret)
+			return ret;
+		seq += count;
+	}
+
+	return 0;
+}
+
+/* Registers of the power up sequence that depend on the lane count */
+static void ar1335_init_lane_regs(struct ar1335_dev *sensor)
+{
+	struct ar1335_reg *regs = sensor->lane_regs;
+
+	regs[0].addr = AR1335_REG_SERIAL_FORMAT;
+	regs[0].val = AR1335_REG_SERIAL_FORMAT_MIPI | sensor->lane_count;
+
+	/* set MIPI test mode - disabled for now */
+	regs[1].addr = AR1335_REG_HISPI_TEST_MODE;
+	regs[1].val = ((0x40 << sensor->lane_count) - 0x40) |
+		      AR1335_REG_HISPI_TEST_MODE_LP11;
+
+	regs[2].addr = AR1335_REG_ROW_SPEED;
+	regs[2].val = 0x110 | 4 / sensor->lane_count;
+}
+
 static int ar1335_power_off(struct device *dev)
 {
 	struct v4l2_subdev *sd = dev_get_drvdata(dev);
 	struct ar1335_dev *sensor = to_ar1335_dev(sd);
-	int i;
 
-	clk_disable_unprepare(sensor->extclk);
+	ar1335_extclk_disable(sensor);
 
-	if (sensor->reset_gpio)
-		gpiod_set_value(sensor->reset_gpio, 1); /* assert RESET signal */
+	/* reset-gpios drives RESET_BAR, a logical 0 holds the sensor in reset */
+	gpiod_set_value_cansleep(sensor->reset_gpio, 0);
 
-	for (i = ARRAY_SIZE(ar1335_supply_names) - 1; i >= 0; i--) {
-		if (sensor->supplies[i])
-			regulator_disable(sensor->supplies[i]);
-	}
+	regulator_bulk_disable(ARRAY_SIZE(sensor->supplies), sensor->supplies);
 	return 0;
 }
 
@@ -1017,35 +2440,44 @@ static int ar1335_power_on(struct device *dev)
 	struct ar1335_dev *sensor = to_ar1335_dev(sd);
 	unsigned int cnt;
 	int ret;
-		gpiod_set_value(sensor->reset_gpio, 0);
-		mdelay(1);
-		gpiod_set_value(sensor->reset_gpio, 1);
-		mdelay(1);
-
-	for (cnt = 0; cnt < ARRAY_SIZE(initial_regs); cnt++) {
-		ret = ar1335_write_regs(sensor, initial_regs[cnt].data,
-					initial_regs[cnt].count);
-		if (ret)
-			goto off;
+
+	/* Keep the sensor in reset while the supplies ramp up */
+	gpiod_set_value_cansleep(sensor->reset_gpio, 0);
+
+	ret = regulator_bulk_enable(ARRAY_SIZE(sensor->supplies),
+				    sensor->supplies);
+	if (ret) {
+		dev_err(dev, "failed to enable supplies: %d\n", ret);
+		return ret;
 	}
 
-	ret = ar1335_write_reg(sensor, AR1335_REG_SERIAL_FORMAT,
-			       AR1335_REG_SERIAL_FORMAT_MIPI |
-			       sensor->lane_count);
-	if (ret)
+	ret = ar1335_extclk_enable(sensor);
+	if (ret) {
+		dev_err(dev, "failed to enable extclk: %d\n", ret);
 		goto off;
+	}
 
-	/* set MIPI test mode - disabled for now */
-	ret = ar1335_write_reg(sensor, AR1335_REG_HISPI_TEST_MODE,
-			       ((0x40 << sensor->lane_count) - 0x40) |
-			       AR1335_REG_HISPI_TEST_MODE_LP11);
+	/* Sleep rather than spin so several sensors can power up together */
+	ar1335_sleep_us(sensor->power_on_delay_us);
+	gpiod_set_value_cansleep(sensor->reset_gpio, 1);
+	ar1335_sleep_us(sensor->reset_delay_us);
+
+	ret = ar1335_write_seq(sensor, initial_regs, ARRAY_SIZE(initial_regs));
 	if (ret)
 		goto off;
 
-	ret = ar1335_write_reg(sensor, AR1335_REG_ROW_SPEED, 0x110 |
-			       4 / sensor->lane_count);
+	/* Cache the reset register so group hold needs a single write */
+	ret = ar1335_read_reg(sensor, AR1335_REG_RESET, &sensor->reset);
 	if (ret)
 		goto off;
+	sensor->frame_length = 0;
+
+	for (cnt = 0; cnt < ARRAY_SIZE(sensor->lane_regs); cnt++) {
+		ret = ar1335_write_reg(sensor, sensor->lane_regs[cnt].addr,
+				       sensor->lane_regs[cnt].val);
+		if (ret)
+			goto off;
+	}
 
 	return 0;
 off:
@@ -1053,16 +2485,56 @@ off:
 	return ret;
 }
 
+/* Report the pedestal the sensor actually uses as the control default */
+static int ar1335_init_pedestal(struct ar1335_dev *sensor)
+{
+	struct v4l2_ctrl *ctrl = sensor->ctrls.data_pedestal;
+	u16 val;
+	int ret;
+
+	ret = ar1335_read_reg(sensor, AR1335_REG_DATA_PEDESTAL, &val);
+	if (ret)
+		return ret;
+
+	val = min_t(u16, val, AR1335_DATA_PEDESTAL_MAX);
+
+	mutex_lock(&sensor->lock);
+	ret = __v4l2_ctrl_modify_range(ctrl, ctrl->minimum, ctrl->maximum,
+				       ctrl->step, val);
+	if (!ret)
+		ret = __v4l2_ctrl_s_ctrl(ctrl, val);
+	mutex_unlock(&sensor->lock);
+
+	return ret;
+}
+
+/* Without factory calibration, the temperature can't be converted */
+static int ar1335_init_thermal(struct ar1335_dev *sensor)
+{
+	u16 *calib = sensor->thermal.calib;
+	int ret;
+
+	ret = ar1335_read_regs(sensor, AR1335_REG_TEMPSENS_CALIB1, calib, 2);
+	if (ret)
+		return ret;
+
+	if (calib[0] == calib[1]) {
+		dev_warn(&sensor->i2c_client->dev,
+			 "no temperature calibration, thermal throttling disabled\n");
+		calib[0] = 0;
+	}
+
+	return 0;
+}
+
 static int ar1335_enum_mbus_code(struct v4l2_subdev *sd,
 				 struct v4l2_subdev_state *sd_state,
 				 struct v4l2_subdev_mbus_code_enum *code)
 {
-	struct ar1335_dev *sensor = to_ar1335_dev(sd);
-
-	if (code->index)
+	if (code->index >= ARRAY_SIZE(ar1335_mbus_codes))
 		return -EINVAL;
 
-	code->code = sensor->fmt.code;
+	code->code = ar1335_mbus_codes[code->index];
 	return 0;
 }
 
@@ -1073,7 +2545,8 @@ static int ar1335_enum_frame_size(struct v4l2_subdev *sd,
 	if (fse->index)
 		return -EINVAL;
 
-	if (fse->code != MEDIA_BUS_FMT_SGRBG10_1X10)
+	if (fse->code != MEDIA_BUS_FMT_SRGGB10_1X10 &&
+	    fse->code != MEDIA_BUS_FMT_SRGGB8_1X8)
 		return -EINVAL;
 
 	fse->min_width = AR1335_WIDTH_MIN;
@@ -1087,10 +2560,21 @@ static int ar1335_enum_frame_size(struct v4l2_subdev *sd,
 static int ar1335_pre_streamon(struct v4l2_subdev *sd, u32 flags)
 {
 	struct ar1335_dev *sensor = to_ar1335_dev(sd);
+	ktime_t start = ktime_get();
 	int ret;
 
 	if (!(flags & V4L2_SUBDEV_PRE_STREAMON_FL_MANUAL_LP))
 		return -EACCES;
+
+	mutex_lock(&sensor->lock);
+
+	/* Do the heavy lifting before the receiver is enabled, if not done */
+	if (!sensor->armed) {
+		ret = ar1335_arm_stream(sensor);
+		if (ret)
+			goto err;
+	}
+
 	/* Set LP-11 on clock and data lanes */
 	ret = ar1335_write_reg(sensor, AR1335_REG_HISPI_CONTROL_STATUS,
 			AR1335_REG_HISPI_CONTROL_STATUS_FRAMER_TEST_MODE_ENABLE);
@@ -1098,20 +2582,39 @@ static int ar1335_pre_streamon(struct v4l2_subdev *sd, u32 flags)
 		goto err;
 
 	/* Start streaming LP-11 */
-	ret = ar1335_write_reg(sensor, AR1335_REG_RESET,
-			       AR1335_REG_RESET_DEFAULTS |
+	ret = ar1335_set_reset(sensor, AR1335_REG_RESET_DEFAULTS |
 			       AR1335_REG_RESET_STREAM);
 	if (ret)
 		goto err;
+
+	sensor->lp11 = true;
+	ar1335_timing_add(&sensor->stats.stream_arm, start);
+	mutex_unlock(&sensor->lock);
 	return 0;
 
 err:
+	sensor->armed = false;
+	mutex_unlock(&sensor->lock);
 	return ret;
 }
 
 static int ar1335_post_streamoff(struct v4l2_subdev *sd)
 {
-	return 0;
+	struct ar1335_dev *sensor = to_ar1335_dev(sd);
+	int ret = 0;
+
+	mutex_lock(&sensor->lock);
+	/*
+	 * Receivers call this without s_stream(0) when s_stream(1) failed,
+	 * the sensor may still be streaming in LP-11 from pre_streamon.
+	 */
+	if (sensor->reset & AR1335_REG_RESET_STREAM)
+		ret = ar1335_set_stream(sensor, false);
+	sensor->armed = false;
+	sensor->lp11 = false;
+	mutex_unlock(&sensor->lock);
+
+	return ret;
 }
 
 static int ar1335_set_frame_interval(struct v4l2_subdev *sd,
@@ -1120,31 +2623,46 @@ static int ar1335_set_frame_interval(struct v4l2_subdev *sd,
 {
 	struct ar1335_dev *sensor = to_ar1335_dev(sd);
 	struct v4l2_fract *tpf = &ival->interval;
+	s32 vblank;
+	u32 fps;
+	int ret;
 
-	if (tpf->numerator == 0 || tpf->denominator == 0 ||
-		(tpf->denominator > tpf->numerator * MAX_FRAME_RATE)) {
-			/* Reset to max frame rate */
-			tpf->numerator = 1;
-			tpf->denominator = MAX_FRAME_RATE;
+	if (tpf->numerator == 0 || tpf->denominator == 0)
+		fps = MAX_FRAME_RATE;
+	else
+		fps = clamp_t(u32, DIV_ROUND_CLOSEST(tpf->denominator,
+						     tpf->numerator),
+			      MIN_FRAME_RATE, MAX_FRAME_RATE);
+
+	if (ival->which == V4L2_SUBDEV_FORMAT_TRY) {
+		tpf->numerator = 1;
+		tpf->denominator = fps;
+		*v4l2_subdev_state_get_interval(state, 0) = *tpf;
+		return 0;
 	}
 
-	sensor->frame_rate.numerator = tpf->numerator;
+	mutex_lock(&sensor->lock);
 
-	if (tpf->numerator == 30) {
-		ar1335_write_reg(sensor, 0x340, 0xC4E);
-		ar1335_write_reg(sensor, 0x202, 0xC4E);
-		sensor->frame_rate.denominator = tpf->denominator;
-	} else if (tpf->numerator == 60) {
-		ar1335_write_reg(sensor, 0x340, 0x626);
-		ar1335_write_reg(sensor, 0x202, 0x5E8);
-		sensor->frame_rate.denominator = tpf->denominator;
-	} else {
-		ar1335_write_reg(sensor, 0x340, 0xC4E);
-		ar1335_write_reg(sensor, 0x202, 0xC4E);
-		sensor->frame_rate.denominator = MIN_FRAME_RATE;
-	}
+	/* Stretch the frame with vertical blanking, the line time is fixed */
+	vblank = ar1335_fps_to_vblank(sensor, fps);
+	ret = __v4l2_ctrl_s_ctrl(sensor->ctrls.vblank, vblank);
+	if (ret)
+		goto out;
 
-	return 0;
+	/* Expose for the whole frame, as the old fixed tables did */
+	ret = __v4l2_ctrl_s_ctrl(sensor->ctrls.exposure,
+				 sensor->fmt.height + vblank -
+				 AR1335_EXPOSURE_MARGIN);
+	if (ret)
+		goto out;
+
+	sensor->req_fps = fps;
+	ar1335_update_frame_rate(sensor);
+	*tpf = sensor->frame_rate;
+
+out:
+	mutex_unlock(&sensor->lock);
+	return ret;
 }
 
 static int ar1335_get_frame_interval(struct v4l2_subdev *sd,
@@ -1153,6 +2671,12 @@ static int ar1335_get_frame_interval(struct v4l2_subdev *sd,
 {
 	struct ar1335_dev *sensor = to_ar1335_dev(sd);
 
+	if (interval->which == V4L2_SUBDEV_FORMAT_TRY) {
+		interval->interval = *v4l2_subdev_state_get_interval(state, 0);
+		return 0;
+	}
+
+	/* The achieved rate depends on controls, it is not kept in state */
 	mutex_lock(&sensor->lock);
 	interval->interval.denominator = sensor->frame_rate.denominator;
 	interval->interval.numerator = sensor->frame_rate.numerator;
@@ -1164,17 +2688,110 @@ static int ar1335_get_frame_interval(struct v4l2_subdev *sd,
 static int ar1335_s_stream(struct v4l2_subdev *sd, int enable)
 {
 	struct ar1335_dev *sensor = to_ar1335_dev(sd);
+	ktime_t start = ktime_get();
 	int ret;
 
+	/* The works take the lock, cancel them before locking */
+	if (!enable) {
+		cancel_delayed_work_sync(&sensor->snapshot_work);
+		cancel_delayed_work_sync(&sensor->frame_work);
+		cancel_delayed_work_sync(&sensor->thermal.work);
+	}
+
 	mutex_lock(&sensor->lock);
+
+	sensor->snapshot_frames = enable ?
+				  sensor->ctrls.snapshot_frames->val : 0;
+	if (enable && (sensor->snapshot_frames ||
+		       atomic_read(&sensor->event_subscribers))) {
+		ret = ar1335_extclk_enable(sensor);
+		if (ret)
+			goto out;
+
+		/* The counter holds while stopped */
+		ret = ar1335_read_reg(sensor, AR1335_REG_FRAME_COUNT,
+				      &sensor->frame_count);
+		if (ret)
+			goto out;
+		sensor->snapshot_start = sensor->frame_count;
+	}
+
+	sensor->ctrls_pending = false;
 	ret = ar1335_set_stream(sensor, enable);
+	if (!ret && sensor->snapshot_frames)
+		schedule_delayed_work(&sensor->snapshot_work,
+				      max(ar1335_frame_jiffies(sensor) / 2, 1UL));
+	if (!ret && enable)
+		schedule_delayed_work(&sensor->frame_work, 0);
+	if (!ret && enable && sensor->thermal.calib[0])
+		schedule_delayed_work(&sensor->thermal.work,
+				      msecs_to_jiffies(AR1335_THERMAL_POLL_MS));
+
+	ar1335_timing_add(enable ? &sensor->stats.stream_on :
+			  &sensor->stats.stream_off, start);
+out:
+	mutex_unlock(&sensor->lock);
+
+	return ret;
+}
+
+static int ar1335_frame_event_add(struct v4l2_subscribed_event *sev,
+				  unsigned int elems)
+{
+	struct v4l2_subdev *sd = vdev_to_v4l2_subdev(sev->fh->vdev);
+	struct ar1335_dev *sensor = to_ar1335_dev(sd);
+	int ret = 0;
+
+	mutex_lock(&sensor->lock);
+	/*
+	 * s_stream(1) only samples the counter with a subscriber present,
+	 * otherwise the first poll would report every frame since then.
+	 */
+	if (sensor->reset & AR1335_REG_RESET_STREAM)
+		ret = ar1335_read_reg(sensor, AR1335_REG_FRAME_COUNT,
+				      &sensor->frame_count);
+	if (!ret) {
+		/* Start polling if already streaming */
+		atomic_inc(&sensor->event_subscribers);
+		schedule_delayed_work(&sensor->frame_work, 0);
+	}
 	mutex_unlock(&sensor->lock);
 
 	return ret;
 }
 
+static void ar1335_frame_event_del(struct v4l2_subscribed_event *sev)
+{
+	struct v4l2_subdev *sd = vdev_to_v4l2_subdev(sev->fh->vdev);
+
+	atomic_dec(&to_ar1335_dev(sd)->event_subscribers);
+}
+
+static const struct v4l2_subscribed_event_ops ar1335_frame_event_ops = {
+	.add = ar1335_frame_event_add,
+	.del = ar1335_frame_event_del,
+};
+
+static int ar1335_subscribe_event(struct v4l2_subdev *sd, struct v4l2_fh *fh,
+				  struct v4l2_event_subscription *sub)
+{
+	switch (sub->type) {
+	case V4L2_EVENT_FRAME_SYNC:
+	case V4L2_EVENT_AR1335_CTRLS_APPLIED:
+		return v4l2_event_subscribe(fh, sub, AR1335_EVENT_QUEUE_LEN,
+					    &ar1335_frame_event_ops);
+	case V4L2_EVENT_AR1335_THERMAL:
+		return v4l2_event_subscribe(fh, sub, AR1335_EVENT_QUEUE_LEN,
+					    NULL);
+	default:
+		return v4l2_ctrl_subdev_subscribe_event(sd, fh, sub);
+	}
+}
+
 static const struct v4l2_subdev_core_ops ar1335_core_ops = {
 	.log_status = v4l2_ctrl_subdev_log_status,
+	.subscribe_event = ar1335_subscribe_event,
+	.unsubscribe_event = v4l2_event_subdev_unsubscribe,
 };
 
 static const struct v4l2_subdev_video_ops ar1335_video_ops = {
@@ -1183,13 +2800,69 @@ static const struct v4l2_subdev_video_ops ar1335_video_ops = {
 	.post_streamoff = ar1335_post_streamoff,
 };
 
+static int ar1335_get_frame_desc(struct v4l2_subdev *sd, unsigned int pad,
+				 struct v4l2_mbus_frame_desc *fd)
+{
+	struct ar1335_dev *sensor = to_ar1335_dev(sd);
+	struct v4l2_mbus_frame_desc_entry *entry = fd->entry;
+	u8 vc;
+
+	memset(fd, 0, sizeof(*fd));
+	fd->type = V4L2_MBUS_FRAME_DESC_TYPE_CSI2;
+
+	mutex_lock(&sensor->lock);
+	vc = sensor->ctrls.virtual_channel->val;
+
+	/* Single stream, the driver does not implement the streams API */
+	entry->stream = 0;
+	entry->pixelcode = sensor->fmt.code;
+	entry->bus.csi2.vc = vc;
+	entry->bus.csi2.dt = ar1335_code_to_bpp(sensor) == 8 ?
+			     MIPI_CSI2_DT_RAW8 : MIPI_CSI2_DT_RAW10;
+	fd->num_entries++;
+
+	/* Register dump lines ahead of the image, same virtual channel */
+	if (sensor->ctrls.test_pattern->val ==
+	    AR1335_TEST_PATTERN_EMBEDDED_DATA) {
+		entry++;
+		entry->stream = 0;
+		entry->pixelcode = MEDIA_BUS_FMT_SENSOR_DATA;
+		entry->bus.csi2.vc = vc;
+		entry->bus.csi2.dt = MIPI_CSI2_DT_EMBEDDED_8B;
+		fd->num_entries++;
+	}
+	mutex_unlock(&sensor->lock);
+
+	return 0;
+}
+
 static const struct v4l2_subdev_pad_ops ar1335_pad_ops = {
 	.enum_mbus_code = ar1335_enum_mbus_code,
 	.enum_frame_size = ar1335_enum_frame_size,
 	.set_frame_interval = ar1335_set_frame_interval,
 	.get_frame_interval = ar1335_get_frame_interval,
-	.get_fmt = ar1335_get_fmt,
+	.get_fmt = v4l2_subdev_get_fmt,
 	.set_fmt = ar1335_set_fmt,
+	.get_frame_desc = ar1335_get_frame_desc,
+};
+
+static int ar1335_init_state(struct v4l2_subdev *sd,
+			     struct v4l2_subdev_state *state)
+{
+	struct v4l2_mbus_framefmt *fmt = v4l2_subdev_state_get_format(state, 0);
+	struct v4l2_fract *interval = v4l2_subdev_state_get_interval(state, 0);
+
+	fmt->width = AR1335_WIDTH_MAX;
+	fmt->height = AR1335_HEIGHT_MAX;
+	ar1335_adj_fmt(fmt);
+
+	interval->numerator = 1;
+	interval->denominator = AR1335_DEF_FRAME_RATE;
+	return 0;
+}
+
+static const struct v4l2_subdev_internal_ops ar1335_internal_ops = {
+	.init_state = ar1335_init_state,
 };
 
 static const struct v4l2_subdev_ops ar1335_subdev_ops = {
@@ -1198,6 +2871,136 @@ static const struct v4l2_subdev_ops ar1335_subdev_ops = {
 	.pad = &ar1335_pad_ops,
 };
 
+static void ar1335_debugfs_timing(struct dentry *parent, const char *name,
+				  struct ar1335_timing *t)
+{
+	struct dentry *dir = debugfs_create_dir(name, parent);
+
+	debugfs_create_u64("count", 0444, dir, &t->count);
+	debugfs_create_u64("last_ns", 0444, dir, &t->last_ns);
+	debugfs_create_u64("max_ns", 0444, dir, &t->max_ns);
+	debugfs_create_u64("total_ns", 0444, dir, &t->total_ns);
+}
+
+static int ar1335_write_verify_get(void *data, u64 *val)
+{
+	struct ar1335_dev *sensor = data;
+
+	*val = sensor->write_verify;
+	return 0;
+}
+
+static int ar1335_write_verify_set(void *data, u64 val)
+{
+	struct ar1335_dev *sensor = data;
+
+	mutex_lock(&sensor->lock);
+	if (!!val != sensor->write_verify) {
+		sensor->write_verify = !!val;
+		if (val)
+			static_branch_inc(&ar1335_write_verify);
+		else
+			static_branch_dec(&ar1335_write_verify);
+	}
+	mutex_unlock(&sensor->lock);
+
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(ar1335_write_verify_fops, ar1335_write_verify_get,
+			 ar1335_write_verify_set, "%llu\n");
+
+/* Counters for tools/ar1335-bench.c, see README.md */
+static void ar1335_debugfs_init(struct ar1335_dev *sensor)
+{
+	struct ar1335_stats *stats = &sensor->stats;
+	struct dentry *dir;
+	char name[32];
+	unsigned int i;
+
+	snprintf(name, sizeof(name), "%s-%s", AR1335_NAME,
+		 dev_name(&sensor->i2c_client->dev));
+	sensor->debugfs = debugfs_create_dir(name, NULL);
+
+	debugfs_create_u64("i2c_xfers", 0444, sensor->debugfs,
+			   &stats->i2c_xfers);
+	debugfs_create_u64("i2c_bytes", 0444, sensor->debugfs,
+			   &stats->i2c_bytes);
+	debugfs_create_u64("i2c_errors", 0444, sensor->debugfs,
+			   &stats->i2c_errors);
+	debugfs_create_bool("readback", 0644, sensor->debugfs,
+			    &sensor->readback);
+	debugfs_create_file_unsafe("write_verify", 0644, sensor->debugfs,
+				   sensor, &ar1335_write_verify_fops);
+	debugfs_create_u64("verify_checks", 0444, sensor->debugfs,
+			   &stats->verify_checks);
+	dir = debugfs_create_dir("verify_mismatches", sensor->debugfs);
+	for (i = 0; i < ARRAY_SIZE(ar1335_verify_ranges); i++)
+		debugfs_create_u64(ar1335_verify_ranges[i].name, 0444, dir,
+				   &stats->verify_mismatches[i]);
+	ar1335_debugfs_timing(sensor->debugfs, "power_on", &stats->power_on);
+	ar1335_debugfs_timing(sensor->debugfs, "set_fmt", &stats->set_fmt);
+	ar1335_debugfs_timing(sensor->debugfs, "s_ctrl", &stats->s_ctrl);
+	ar1335_debugfs_timing(sensor->debugfs, "stream_arm",
+			      &stats->stream_arm);
+	ar1335_debugfs_timing(sensor->debugfs, "stream_on", &stats->stream_on);
+	ar1335_debugfs_timing(sensor->debugfs, "stream_off",
+			      &stats->stream_off);
+}
+
+/*
+ * Pick the extclk rate from the optional DT "onnn,extclk-frequencies" list
+ * that gives the closest PLL output to the target, preferring the lowest VCO
+ * on ties. Keeps the current rate when the list is absent or unusable.
+ */
+static void ar1335_select_extclk(struct ar1335_dev *sensor)
+{
+	struct device *dev = &sensor->i2c_client->dev;
+	u32 rates[AR1335_EXTCLK_RATES_MAX];
+	u32 vco = ar1335_pll_target(sensor);
+	u32 best_rate = 0, best_err = U32_MAX, best_pll = U32_MAX;
+	u32 pll, err;
+	u16 pre, mult;
+	int count, i, ret;
+	long rate;
+
+	count = device_property_count_u32(dev, "onnn,extclk-frequencies");
+	if (count <= 0)
+		return;
+
+	count = min_t(int, count, ARRAY_SIZE(rates));
+	ret = device_property_read_u32_array(dev, "onnn,extclk-frequencies",
+					     rates, count);
+	if (ret)
+		return;
+
+	for (i = 0; i < count; i++) {
+		/* Evaluate the rate the clock can actually provide */
+		rate = clk_round_rate(sensor->extclk, rates[i]);
+		if (rate < AR1335_EXTCLK_MIN || rate > AR1335_EXTCLK_MAX)
+			continue;
+
+		sensor->extclk_freq = rate;
+		pll = calc_pll(sensor, vco, &pre, &mult);
+		err = abs_diff(pll, vco);
+		if (err < best_err || (err == best_err && pll < best_pll)) {
+			best_rate = rate;
+			best_err = err;
+			best_pll = pll;
+		}
+	}
+
+	if (!best_rate) {
+		dev_warn(dev, "no usable onnn,extclk-frequencies entry\n");
+		return;
+	}
+
+	ret = clk_set_rate(sensor->extclk, best_rate);
+	if (ret)
+		dev_warn(dev, "failed to set extclk to %u Hz: %d\n",
+			 best_rate, ret);
+}
+
 static int ar1335_probe(struct i2c_client *client)
 {
 	struct v4l2_fwnode_endpoint ep = {
@@ -1207,6 +3010,7 @@ static int ar1335_probe(struct i2c_client *client)
 	struct fwnode_handle *endpoint;
 	struct ar1335_dev *sensor;
 	unsigned int cnt;
+	ktime_t start;
 	int ret;
 
 	sensor = devm_kzalloc(dev, sizeof(*sensor), GFP_KERNEL);
@@ -1216,8 +3020,12 @@ static int ar1335_probe(struct i2c_client *client)
 	sensor->i2c_client = client;
 	sensor->fmt.width = AR1335_WIDTH_MAX;
 	sensor->fmt.height = AR1335_HEIGHT_MAX;
+	sensor->skip = 1;
+	/* The full array is not a table mode */
+	sensor->cur_res = -1;
 	sensor->frame_rate.numerator = 1;
 	sensor->frame_rate.denominator = AR1335_DEF_FRAME_RATE;
+	sensor->req_fps = AR1335_DEF_FRAME_RATE;
 	endpoint = fwnode_graph_get_endpoint_by_id(dev_fwnode(dev), 0, 0,
 						   FWNODE_GRAPH_ENDPOINT_NEXT);
 	if (!endpoint) {
@@ -1247,6 +3055,9 @@ static int ar1335_probe(struct i2c_client *client)
 		dev_err(dev, "invalid number of MIPI data lanes\n");
 		return -EINVAL;
 	}
+	ar1335_init_lane_regs(sensor);
+	ar1335_adj_fmt(&sensor->fmt);
+
 	/* Get master clock (extclk) */
 	sensor->extclk = devm_clk_get(dev, "extclk");
 	if (IS_ERR(sensor->extclk)) {
@@ -1254,6 +3065,7 @@ static int ar1335_probe(struct i2c_client *client)
 		return PTR_ERR(sensor->extclk);
 	}
 
+	ar1335_select_extclk(sensor);
 	sensor->extclk_freq = clk_get_rate(sensor->extclk);
 
 	if (sensor->extclk_freq < AR1335_EXTCLK_MIN ||
@@ -1264,51 +3076,106 @@ static int ar1335_probe(struct i2c_client *client)
 	}
 	dev_info(&client->dev, "Sensor is running at %u Hz input clock\n", sensor->extclk_freq); 
 
-	/* Request optional reset pin (usually active low) and assert it */
+	/* Request optional reset pin and hold the sensor in reset */
 	sensor->reset_gpio = devm_gpiod_get_optional(dev, "reset",
-						     GPIOD_OUT_HIGH);
+						     GPIOD_OUT_LOW);
+	if (IS_ERR(sensor->reset_gpio))
+		return PTR_ERR(sensor->reset_gpio);
 
 	v4l2_i2c_subdev_init(&sensor->sd, client, &ar1335_subdev_ops);
 
-	sensor->sd.flags = V4L2_SUBDEV_FL_HAS_DEVNODE;
+	sensor->sd.internal_ops = &ar1335_internal_ops;
+	sensor->sd.flags = V4L2_SUBDEV_FL_HAS_DEVNODE |
+			   V4L2_SUBDEV_FL_HAS_EVENTS;
 	sensor->pad.flags = MEDIA_PAD_FL_SOURCE;
 	sensor->sd.entity.function = MEDIA_ENT_F_CAM_SENSOR;
 	ret = media_entity_pads_init(&sensor->sd.entity, 1, &sensor->pad);
 	if (ret)
 		return ret;
 
-	for (cnt = 0; cnt < ARRAY_SIZE(ar1335_supply_names); cnt++) {
-		struct regulator *supply = devm_regulator_get(dev,
-						ar1335_supply_names[cnt]);
+	for (cnt = 0; cnt < ARRAY_SIZE(ar1335_supply_names); cnt++)
+		sensor->supplies[cnt].supply = ar1335_supply_names[cnt];
 
-		if (IS_ERR(supply)) {
-			dev_info(dev, "no %s regulator found: %li\n",
-				 ar1335_supply_names[cnt], PTR_ERR(supply));
-			return PTR_ERR(supply);
-		}
-		sensor->supplies[cnt] = supply;
+	ret = devm_regulator_bulk_get(dev, ARRAY_SIZE(sensor->supplies),
+				      sensor->supplies);
+	if (ret) {
+		dev_info(dev, "failed to get regulators: %d\n", ret);
+		return ret;
+	}
+
+	sensor->power_on_delay_us = AR1335_POWER_ON_DELAY_US;
+	device_property_read_u32(dev, "onnn,power-on-delay-us",
+				 &sensor->power_on_delay_us);
+	sensor->reset_delay_us = AR1335_RESET_DELAY_US;
+	device_property_read_u32(dev, "onnn,reset-delay-us",
+				 &sensor->reset_delay_us);
+
+	device_property_read_u32(dev, "onnn,virtual-channel",
+				 &sensor->virtual_channel);
+	if (sensor->virtual_channel > AR1335_VIRTUAL_CHANNEL_MAX) {
+		dev_err(dev, "invalid virtual channel %u\n",
+			sensor->virtual_channel);
+		return -EINVAL;
 	}
 
 	mutex_init(&sensor->lock);
+	INIT_DELAYED_WORK(&sensor->snapshot_work, ar1335_snapshot_work);
+	INIT_DELAYED_WORK(&sensor->standby_work, ar1335_standby_work);
+	INIT_DELAYED_WORK(&sensor->frame_work, ar1335_frame_work);
+	INIT_DELAYED_WORK(&sensor->thermal.work, ar1335_thermal_work);
 
 	ret = ar1335_init_controls(sensor);
 	if (ret)
 		goto entity_cleanup;
 
-	ar1335_adj_fmt(&sensor->fmt);
-
-	ret = v4l2_async_register_subdev(&sensor->sd);
+	mutex_lock(&sensor->lock);
+	ar1335_calc_pll(sensor);
+	ret = ar1335_update_link_ctrls(sensor);
+	mutex_unlock(&sensor->lock);
 	if (ret)
 		goto free_ctrls;
+
+	/*
+	 * Bring the sensor fully up before exposing it to the media graph.
+	 * With asynchronous probing, sensors on separate adapters do this
+	 * concurrently.
+	 */
+	start = ktime_get();
 	ret = ar1335_power_on(&client->dev);
 	if (ret)
-		goto disable;
+		goto free_ctrls;
+	ar1335_timing_add(&sensor->stats.power_on, start);
+	ret = ar1335_init_pedestal(sensor);
+	if (ret)
+		goto power_off;
+	ret = ar1335_init_thermal(sensor);
+	if (ret)
+		goto power_off;
+
+	/* Idle in software standby until the first stream */
+	mutex_lock(&sensor->lock);
+	ar1335_extclk_disable(sensor);
+	mutex_unlock(&sensor->lock);
+
+	/*
+	 * The active state keeps its own lock, so TRY negotiation on other
+	 * file handles never waits for sensor->lock.
+	 */
+	ret = v4l2_subdev_init_finalize(&sensor->sd);
+	if (ret)
+		goto power_off;
+
+	ret = v4l2_async_register_subdev(&sensor->sd);
+	if (ret)
+		goto subdev_cleanup;
+	ar1335_debugfs_init(sensor);
 	dev_info(&client->dev, "AR1335 probe completed successfully\n");
 	return 0;
 
-disable:
-	v4l2_async_unregister_subdev(&sensor->sd);
-	media_entity_cleanup(&sensor->sd.entity);
+subdev_cleanup:
+	v4l2_subdev_cleanup(&sensor->sd);
+power_off:
+	ar1335_power_off(&client->dev);
 free_ctrls:
 	v4l2_ctrl_handler_free(&sensor->ctrls.handler);
 entity_cleanup:
@@ -1322,7 +3189,16 @@ static void ar1335_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct ar1335_dev *sensor = to_ar1335_dev(sd);
 
+	debugfs_remove_recursive(sensor->debugfs);
+	if (sensor->write_verify)
+		static_branch_dec(&ar1335_write_verify);
 	v4l2_async_unregister_subdev(&sensor->sd);
+	v4l2_subdev_cleanup(&sensor->sd);
+	cancel_delayed_work_sync(&sensor->snapshot_work);
+	cancel_delayed_work_sync(&sensor->standby_work);
+	cancel_delayed_work_sync(&sensor->frame_work);
+	cancel_delayed_work_sync(&sensor->thermal.work);
+	ar1335_power_off(&client->dev);
 	media_entity_cleanup(&sensor->sd.entity);
 	v4l2_ctrl_handler_free(&sensor->ctrls.handler);
 	mutex_destroy(&sensor->lock);
@@ -1338,6 +3214,7 @@ static struct i2c_driver ar1335_driver = {
 	.driver = {
 		.name  = AR1335_NAME,
 		.of_match_table = ar1335_id,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.probe = ar1335_probe,
 	.remove = ar1335_remove,
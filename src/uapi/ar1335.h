@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * AR1335 driver specific controls and events
+ *
+ * Copyright (C) 2024 Advanced Micro Devices, Inc.
+ */
+
+#ifndef __UAPI_AR1335_H
+#define __UAPI_AR1335_H
+
+#include <linux/videodev2.h>
+
+/* Driver specific controls */
+#define V4L2_CID_AR1335_BASE			(V4L2_CID_USER_BASE | 0xf000)
+#define V4L2_CID_AR1335_DEFECT_CORRECTION	(V4L2_CID_AR1335_BASE + 0)
+#define V4L2_CID_AR1335_NOISE_CORRECTION	(V4L2_CID_AR1335_BASE + 1)
+#define V4L2_CID_AR1335_DATA_PEDESTAL		(V4L2_CID_AR1335_BASE + 2)
+#define V4L2_CID_AR1335_AUTO_FRAME_RATE		(V4L2_CID_AR1335_BASE + 3)
+#define V4L2_CID_AR1335_MIN_FRAME_RATE		(V4L2_CID_AR1335_BASE + 4)
+#define V4L2_CID_AR1335_SNAPSHOT_FRAMES		(V4L2_CID_AR1335_BASE + 5)
+#define V4L2_CID_AR1335_VIRTUAL_CHANNEL		(V4L2_CID_AR1335_BASE + 6)
+#define V4L2_CID_AR1335_FRAME_LENGTH		(V4L2_CID_AR1335_BASE + 7)
+#define V4L2_CID_AR1335_POWER_ESTIMATE		(V4L2_CID_AR1335_BASE + 8)
+#define V4L2_CID_AR1335_TEMPERATURE		(V4L2_CID_AR1335_BASE + 9)
+#define V4L2_CID_AR1335_THERMAL_THRESHOLD	(V4L2_CID_AR1335_BASE + 10)
+#define V4L2_CID_AR1335_THERMAL_HYSTERESIS	(V4L2_CID_AR1335_BASE + 11)
+#define V4L2_CID_AR1335_PROGRAMMED_EXPOSURE	(V4L2_CID_AR1335_BASE + 12)
+#define V4L2_CID_AR1335_PROGRAMMED_GAIN		(V4L2_CID_AR1335_BASE + 13)
+#define V4L2_CID_AR1335_PROGRAMMED_RED_BALANCE	(V4L2_CID_AR1335_BASE + 14)
+#define V4L2_CID_AR1335_PROGRAMMED_BLUE_BALANCE	(V4L2_CID_AR1335_BASE + 15)
+
+/* Driver specific events, frame_sync.frame_sequence holds the frame */
+#define V4L2_EVENT_AR1335_CTRLS_APPLIED		(V4L2_EVENT_PRIVATE_START + 1)
+/* u.data[0] holds the new throttle level, u.data[1] the temperature in C */
+#define V4L2_EVENT_AR1335_THERMAL		(V4L2_EVENT_PRIVATE_START + 2)
+
+#endif /* __UAPI_AR1335_H */
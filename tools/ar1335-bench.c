@@ -0,0 +1,884 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * AR1335 stream and mode switch benchmark
+ *
+ * Copyright (C) 2024 Advanced Micro Devices, Inc.
+ *
+ * Runs set_fmt, control and stream on/off cycles against the ar1335 subdev
+ * and reports latency percentiles, together with the I2C traffic and the
+ * driver side timings exported by the driver in debugfs. Control writes can
+ * also be logged one per line to a CSV file. The stress test issues the
+ * same operations from several threads at once to shake out locking bugs.
+ *
+ * Build: gcc -O2 -Wall -pthread -o ar1335-bench tools/ar1335-bench.c
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/v4l2-subdev.h>
+#include <linux/videodev2.h>
+
+#define NUM_BUFFERS	4
+/* Time the stress threads get to return once asked to stop */
+#define STRESS_HANG_TIMEOUT_S	5
+
+struct samples {
+	double *us;
+	unsigned int count;
+	unsigned int max;
+};
+
+static const char *debugfs_dir;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int xioctl(int fd, unsigned long req, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, req, arg);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+/* Read a counter exported by the driver, 0 when debugfs isn't available */
+static uint64_t read_counter(const char *name)
+{
+	char path[512];
+	uint64_t val = 0;
+	FILE *f;
+
+	if (!debugfs_dir)
+		return 0;
+
+	snprintf(path, sizeof(path), "%s/%s", debugfs_dir, name);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%" SCNu64, &val) != 1)
+		val = 0;
+	fclose(f);
+
+	return val;
+}
+
+static const char *find_debugfs_dir(void)
+{
+	static char dir[256];
+	glob_t g;
+
+	if (glob("/sys/kernel/debug/ar1335-*", 0, NULL, &g))
+		return NULL;
+
+	snprintf(dir, sizeof(dir), "%s", g.gl_pathv[0]);
+	if (g.gl_pathc > 1)
+		fprintf(stderr, "several sensors found, using %s\n", dir);
+	globfree(&g);
+
+	return dir;
+}
+
+static void samples_init(struct samples *s, unsigned int max)
+{
+	s->us = calloc(max, sizeof(*s->us));
+	s->count = 0;
+	s->max = max;
+	if (!s->us) {
+		perror("calloc");
+		exit(1);
+	}
+}
+
+/* Grows the array for runs that are bounded by time, not iterations */
+static void samples_add(struct samples *s, double us)
+{
+	if (s->count == s->max) {
+		s->max *= 2;
+		s->us = realloc(s->us, s->max * sizeof(*s->us));
+		if (!s->us) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	s->us[s->count++] = us;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const struct samples *s, unsigned int pct)
+{
+	unsigned int idx;
+
+	if (!s->count)
+		return 0;
+
+	idx = (s->count - 1) * pct / 100;
+	return s->us[idx];
+}
+
+static void print_header(void)
+{
+	printf("%-20s %8s %10s %10s %10s %10s %10s %12s\n", "operation",
+	       "count", "p50_us", "p90_us", "p99_us", "max_us", "drv_us",
+	       "i2c_per_op");
+}
+
+/*
+ * Print the percentiles of one operation, with the average time spent in
+ * the driver and the I2C transfers it issued per operation.
+ */
+static void report(const char *name, struct samples *s, uint64_t drv_ns,
+		   uint64_t i2c_xfers)
+{
+	double n = s->count ? s->count : 1;
+
+	qsort(s->us, s->count, sizeof(*s->us), cmp_double);
+	printf("%-20s %8u %10.1f %10.1f %10.1f %10.1f %10.1f %12.1f\n", name,
+	       s->count, percentile(s, 50), percentile(s, 90),
+	       percentile(s, 99), s->count ? s->us[s->count - 1] : 0,
+	       drv_ns / 1e3 / n, i2c_xfers / n);
+}
+
+/* Driver counters, sampled before and after a run */
+struct drv_snapshot {
+	uint64_t i2c_xfers;
+	uint64_t total_ns;
+};
+
+/* stat names a timing directory in debugfs, or is NULL */
+static void snapshot(struct drv_snapshot *snap, const char *stat)
+{
+	char name[64];
+
+	snap->i2c_xfers = read_counter("i2c_xfers");
+	snap->total_ns = 0;
+	if (stat) {
+		snprintf(name, sizeof(name), "%s/total_ns", stat);
+		snap->total_ns = read_counter(name);
+	}
+}
+
+static void report_delta(const char *name, struct samples *s,
+			 const char *stat, const struct drv_snapshot *before)
+{
+	struct drv_snapshot after;
+
+	snapshot(&after, stat);
+	report(name, s, after.total_ns - before->total_ns,
+	       after.i2c_xfers - before->i2c_xfers);
+}
+
+/* Alternate between the 1080p and 2160p modes */
+static int bench_fmt(int fd, unsigned int iterations)
+{
+	static const struct {
+		unsigned int width, height;
+	} sizes[] = {
+		{ 1920, 1080 },
+		{ 3840, 2160 },
+	};
+	struct v4l2_subdev_format fmt;
+	struct drv_snapshot before;
+	struct samples s;
+	unsigned int i;
+	double t;
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+	if (xioctl(fd, VIDIOC_SUBDEV_G_FMT, &fmt) < 0) {
+		perror("VIDIOC_SUBDEV_G_FMT");
+		return -1;
+	}
+
+	samples_init(&s, iterations);
+	snapshot(&before, "set_fmt");
+
+	for (i = 0; i < iterations; i++) {
+		fmt.format.width = sizes[i % 2].width;
+		fmt.format.height = sizes[i % 2].height;
+
+		t = now_us();
+		if (xioctl(fd, VIDIOC_SUBDEV_S_FMT, &fmt) < 0) {
+			perror("VIDIOC_SUBDEV_S_FMT");
+			free(s.us);
+			return -1;
+		}
+		samples_add(&s, now_us() - t);
+	}
+
+	report_delta("set_fmt", &s, "set_fmt", &before);
+	free(s.us);
+	return 0;
+}
+
+/* Controls exercised by the ctrl test, as issued by an AE loop */
+static const struct {
+	unsigned int id;
+	const char *name;
+} bench_ctrls[] = {
+	{ V4L2_CID_EXPOSURE, "exposure" },
+	{ V4L2_CID_ANALOGUE_GAIN, "analogue_gain" },
+	{ V4L2_CID_GAIN, "gain" },
+	{ V4L2_CID_HBLANK, "hblank" },
+	{ V4L2_CID_VBLANK, "vblank" },
+	{ V4L2_CID_TEST_PATTERN, "test_pattern" },
+};
+
+enum ctrl_api {
+	API_S_CTRL,
+	API_S_EXT_CTRLS,
+};
+
+static int set_ctrl(int fd, enum ctrl_api api, unsigned int id, int value)
+{
+	struct v4l2_control ctrl = { .id = id, .value = value };
+	struct v4l2_ext_control ext = { .id = id, .value = value };
+	struct v4l2_ext_controls ctrls = {
+		.which = V4L2_CTRL_WHICH_CUR_VAL,
+		.count = 1,
+		.controls = &ext,
+	};
+
+	if (api == API_S_CTRL)
+		return xioctl(fd, VIDIOC_S_CTRL, &ctrl);
+
+	return xioctl(fd, VIDIOC_S_EXT_CTRLS, &ctrls);
+}
+
+/*
+ * Tight loops of control writes through both S_CTRL and S_EXT_CTRLS,
+ * alternating between two values so that every write reaches the sensor.
+ * Each call is optionally logged to csv with the number of I2C transfers
+ * it caused. Every control is set back to its value from before the test.
+ */
+static int bench_ctrl(int fd, unsigned int iterations, FILE *csv)
+{
+	static const char * const api_names[] = { "s_ctrl", "s_ext_ctrls" };
+	unsigned int c, i;
+	int api, ret = 0;
+
+	for (c = 0; c < sizeof(bench_ctrls) / sizeof(bench_ctrls[0]); c++) {
+		struct v4l2_queryctrl qc = { .id = bench_ctrls[c].id };
+		struct v4l2_control saved = { .id = bench_ctrls[c].id };
+		int values[2];
+
+		if (xioctl(fd, VIDIOC_QUERYCTRL, &qc) < 0 ||
+		    qc.flags & (V4L2_CTRL_FLAG_DISABLED |
+				V4L2_CTRL_FLAG_READ_ONLY)) {
+			fprintf(stderr, "skipping %s\n", bench_ctrls[c].name);
+			continue;
+		}
+
+		if (xioctl(fd, VIDIOC_G_CTRL, &saved) < 0) {
+			perror("VIDIOC_G_CTRL");
+			return -1;
+		}
+
+		values[0] = qc.default_value;
+		values[1] = qc.default_value != qc.minimum ? qc.minimum :
+			    qc.minimum + qc.step;
+
+		for (api = API_S_CTRL; api <= API_S_EXT_CTRLS; api++) {
+			struct drv_snapshot before;
+			char name[64];
+			struct samples s;
+			uint64_t xfers = 0;
+
+			samples_init(&s, iterations);
+			snapshot(&before, "s_ctrl");
+
+			for (i = 0; i < iterations; i++) {
+				double t;
+
+				if (csv)
+					xfers = read_counter("i2c_xfers");
+
+				t = now_us();
+				if (set_ctrl(fd, api, qc.id, values[i % 2]) < 0) {
+					perror(api_names[api]);
+					free(s.us);
+					ret = -1;
+					goto restore;
+				}
+				t = now_us() - t;
+				samples_add(&s, t);
+
+				if (csv)
+					fprintf(csv, "%s,%s,%u,%.3f,%" PRIu64 "\n",
+						bench_ctrls[c].name,
+						api_names[api], i, t,
+						read_counter("i2c_xfers") -
+						xfers);
+			}
+
+			snprintf(name, sizeof(name), "%s/%s",
+				 bench_ctrls[c].name,
+				 api == API_S_CTRL ? "ctrl" : "ext");
+			report_delta(name, &s, "s_ctrl", &before);
+			free(s.us);
+		}
+
+restore:
+		if (xioctl(fd, VIDIOC_S_CTRL, &saved) < 0) {
+			perror("restoring control");
+			ret = -1;
+		}
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Buffers are never read, so they are queued without being mapped */
+static void init_buffer(struct v4l2_buffer *buf, struct v4l2_plane *planes,
+			enum v4l2_buf_type type, unsigned int index)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->index = index;
+	buf->type = type;
+	buf->memory = V4L2_MEMORY_MMAP;
+	if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+		buf->m.planes = planes;
+		buf->length = VIDEO_MAX_PLANES;
+	}
+}
+
+static int queue_buffers(int fd, enum v4l2_buf_type type)
+{
+	struct v4l2_requestbuffers req = {
+		.count = NUM_BUFFERS,
+		.type = type,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	unsigned int i;
+
+	if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
+		perror("VIDIOC_REQBUFS");
+		return -1;
+	}
+
+	for (i = 0; i < req.count; i++) {
+		struct v4l2_plane planes[VIDEO_MAX_PLANES];
+		struct v4l2_buffer buf;
+
+		init_buffer(&buf, planes, type, i);
+		if (xioctl(fd, VIDIOC_QBUF, &buf) < 0) {
+			perror("VIDIOC_QBUF");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int free_buffers(int fd, enum v4l2_buf_type type)
+{
+	struct v4l2_requestbuffers req = {
+		.count = 0,
+		.type = type,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+
+	return xioctl(fd, VIDIOC_REQBUFS, &req);
+}
+
+/*
+ * Full stream cycles through the capture video node: STREAMON, wait for the
+ * first frame, STREAMOFF. The driver side of STREAMON is split between
+ * pre_streamon (stream_arm) and s_stream(1) (stream_on). I2C transfers are
+ * counted around each ioctl only, the frame polling in between runs while
+ * streaming.
+ */
+static int bench_stream(int fd, unsigned int iterations)
+{
+	struct drv_snapshot arm_before, on_before, arm_after, on_after;
+	struct drv_snapshot off_before, off_after;
+	struct samples s_on, s_first, s_off;
+	uint64_t on_xfers = 0, off_xfers = 0, xfers;
+	struct v4l2_capability cap;
+	enum v4l2_buf_type type;
+	int allocated = 0, streaming = 0;
+	unsigned int i;
+	int ret = -1;
+
+	if (xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) {
+		perror("VIDIOC_QUERYCAP");
+		return -1;
+	}
+
+	if (cap.device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
+		type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	else
+		type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	samples_init(&s_on, iterations);
+	samples_init(&s_first, iterations);
+	samples_init(&s_off, iterations);
+	snapshot(&arm_before, "stream_arm");
+	snapshot(&on_before, "stream_on");
+	snapshot(&off_before, "stream_off");
+
+	for (i = 0; i < iterations; i++) {
+		struct v4l2_plane planes[VIDEO_MAX_PLANES];
+		struct v4l2_buffer buf;
+		double start;
+
+		init_buffer(&buf, planes, type, 0);
+		allocated = 1;
+		if (queue_buffers(fd, type))
+			goto out;
+
+		xfers = read_counter("i2c_xfers");
+		start = now_us();
+		if (xioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+			perror("VIDIOC_STREAMON");
+			goto out;
+		}
+		samples_add(&s_on, now_us() - start);
+		on_xfers += read_counter("i2c_xfers") - xfers;
+		streaming = 1;
+
+		if (xioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
+			perror("VIDIOC_DQBUF");
+			goto out;
+		}
+		samples_add(&s_first, now_us() - start);
+
+		xfers = read_counter("i2c_xfers");
+		start = now_us();
+		if (xioctl(fd, VIDIOC_STREAMOFF, &type) < 0) {
+			perror("VIDIOC_STREAMOFF");
+			goto out;
+		}
+		samples_add(&s_off, now_us() - start);
+		off_xfers += read_counter("i2c_xfers") - xfers;
+		streaming = 0;
+
+		free_buffers(fd, type);
+		allocated = 0;
+	}
+
+	/* STREAMON covers both pre_streamon and s_stream(1) */
+	snapshot(&arm_after, "stream_arm");
+	snapshot(&on_after, "stream_on");
+	snapshot(&off_after, "stream_off");
+	report("streamon", &s_on,
+	       arm_after.total_ns - arm_before.total_ns +
+	       on_after.total_ns - on_before.total_ns, on_xfers);
+	report("first_frame", &s_first, 0, 0);
+	report("streamoff", &s_off, off_after.total_ns - off_before.total_ns,
+	       off_xfers);
+	ret = 0;
+out:
+	/* Leave the device idle for the next run after an error */
+	if (streaming)
+		xioctl(fd, VIDIOC_STREAMOFF, &type);
+	if (allocated)
+		free_buffers(fd, type);
+	free(s_on.us);
+	free(s_first.us);
+	free(s_off.us);
+	return ret;
+}
+
+/* Operations issued by the stress test */
+enum stress_op {
+	OP_FMT_ACTIVE,
+	OP_FMT_TRY,
+	OP_FRAME_INTERVAL,
+	OP_S_EXT_CTRLS,
+	OP_G_CTRL,
+	OP_STREAM,	/* only on the streaming thread */
+	NUM_STRESS_OPS,
+};
+
+static const char * const stress_op_names[] = {
+	"fmt_active", "fmt_try", "frame_interval", "s_ext_ctrls", "g_ctrl",
+	"stream_cycle",
+};
+
+struct stress_thread {
+	pthread_t thread;
+	unsigned int seed;
+	int fd;
+	int video_fd;
+	struct samples s[NUM_STRESS_OPS];
+	unsigned int errors[NUM_STRESS_OPS];
+	int done;
+};
+
+/* Set once to end the run, polled by every thread */
+static int stress_stop;
+
+static int stress_fmt(int fd, uint32_t which, unsigned int *seed)
+{
+	struct v4l2_subdev_format fmt = { .which = which };
+	int big = rand_r(seed) & 1;
+
+	if (xioctl(fd, VIDIOC_SUBDEV_G_FMT, &fmt) < 0)
+		return -1;
+
+	fmt.format.width = big ? 3840 : 1920;
+	fmt.format.height = big ? 2160 : 1080;
+	return xioctl(fd, VIDIOC_SUBDEV_S_FMT, &fmt);
+}
+
+/* Exposure and gain together, as an AE loop would, clamped by the driver */
+static int stress_ctrls(int fd, unsigned int *seed)
+{
+	struct v4l2_ext_control ext[] = {
+		{ .id = V4L2_CID_EXPOSURE, .value = rand_r(seed) % 4096 },
+		{ .id = V4L2_CID_GAIN, .value = rand_r(seed) % 512 },
+	};
+	struct v4l2_ext_controls ctrls = {
+		.which = V4L2_CTRL_WHICH_CUR_VAL,
+		.count = 2,
+		.controls = ext,
+	};
+
+	return xioctl(fd, VIDIOC_S_EXT_CTRLS, &ctrls);
+}
+
+static int stress_stream(int fd)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	struct v4l2_capability cap;
+	struct v4l2_buffer buf;
+	int ret = -1;
+
+	if (xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0)
+		return -1;
+	if (!(cap.device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE))
+		type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	init_buffer(&buf, planes, type, 0);
+	if (queue_buffers(fd, type))
+		goto out;
+
+	if (xioctl(fd, VIDIOC_STREAMON, &type) < 0)
+		goto out;
+
+	ret = xioctl(fd, VIDIOC_DQBUF, &buf);
+	if (xioctl(fd, VIDIOC_STREAMOFF, &type) < 0)
+		ret = -1;
+out:
+	free_buffers(fd, type);
+	return ret;
+}
+
+static int stress_one(struct stress_thread *t, enum stress_op op)
+{
+	struct v4l2_subdev_frame_interval ival = {
+		.interval = { 1, rand_r(&t->seed) & 1 ? 30 : 60 },
+	};
+	struct v4l2_control ctrl = { .id = V4L2_CID_EXPOSURE };
+
+	switch (op) {
+	case OP_FMT_ACTIVE:
+		return stress_fmt(t->fd, V4L2_SUBDEV_FORMAT_ACTIVE, &t->seed);
+	case OP_FMT_TRY:
+		return stress_fmt(t->fd, V4L2_SUBDEV_FORMAT_TRY, &t->seed);
+	case OP_FRAME_INTERVAL:
+		return xioctl(t->fd, VIDIOC_SUBDEV_S_FRAME_INTERVAL, &ival);
+	case OP_S_EXT_CTRLS:
+		return stress_ctrls(t->fd, &t->seed);
+	case OP_G_CTRL:
+		return xioctl(t->fd, VIDIOC_G_CTRL, &ctrl);
+	default:
+		return stress_stream(t->video_fd);
+	}
+}
+
+static void *stress_run(void *arg)
+{
+	struct stress_thread *t = arg;
+
+	while (!__atomic_load_n(&stress_stop, __ATOMIC_RELAXED)) {
+		enum stress_op op = t->video_fd >= 0 ? OP_STREAM :
+				    rand_r(&t->seed) % OP_STREAM;
+		double start = now_us();
+		int ret = stress_one(t, op);
+
+		samples_add(&t->s[op], now_us() - start);
+		if (ret < 0)
+			t->errors[op]++;
+	}
+
+	__atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Hammer the subdev from nthreads threads, each with its own file handle,
+ * plus one thread cycling the stream when a video node is given. Failed
+ * calls are counted, not fatal: set_fmt racing with STREAMON is expected
+ * to fail link validation now and then. A thread still stuck in the driver
+ * after the run is reported as a hang.
+ */
+static int bench_stress(const char *subdev, int video_fd,
+			unsigned int nthreads, unsigned int seconds)
+{
+	unsigned int total = nthreads + (video_fd >= 0);
+	struct stress_thread **threads;
+	struct drv_snapshot before, after;
+	double start, elapsed, deadline;
+	unsigned int i, op, stuck = 0;
+	int ret = -1;
+
+	threads = calloc(total, sizeof(*threads));
+	if (!threads) {
+		perror("calloc");
+		return -1;
+	}
+
+	for (i = 0; i < total; i++) {
+		struct stress_thread *t = calloc(1, sizeof(*t));
+
+		if (!t) {
+			perror("calloc");
+			exit(1);
+		}
+		threads[i] = t;
+		t->seed = i + 1;
+		t->video_fd = i == nthreads ? video_fd : -1;
+		t->fd = open(subdev, O_RDWR);
+		if (t->fd < 0) {
+			perror(subdev);
+			exit(1);
+		}
+		for (op = 0; op < NUM_STRESS_OPS; op++)
+			samples_init(&t->s[op], 1024);
+	}
+
+	snapshot(&before, NULL);
+	__atomic_store_n(&stress_stop, 0, __ATOMIC_RELAXED);
+	start = now_us();
+	for (i = 0; i < total; i++) {
+		if (pthread_create(&threads[i]->thread, NULL, stress_run,
+				   threads[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	sleep(seconds);
+	__atomic_store_n(&stress_stop, 1, __ATOMIC_RELAXED);
+	elapsed = (now_us() - start) / 1e6;
+
+	deadline = now_us() + STRESS_HANG_TIMEOUT_S * 1e6;
+	for (i = 0; i < total; i++) {
+		struct stress_thread *t = threads[i];
+
+		while (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE) &&
+		       now_us() < deadline)
+			usleep(10000);
+		if (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+			fprintf(stderr, "thread %u stuck for %u s, driver hang?\n",
+				i, STRESS_HANG_TIMEOUT_S);
+			/*
+			 * The thread still owns its state and may return at
+			 * any time, so it is leaked. Closing the fd is safe,
+			 * the call in progress holds its own file reference.
+			 */
+			close(t->fd);
+			pthread_detach(t->thread);
+			threads[i] = NULL;
+			stuck++;
+			continue;
+		}
+		pthread_join(t->thread, NULL);
+	}
+	if (stuck)
+		goto out;
+	snapshot(&after, NULL);
+
+	/* Merge the samples of all threads, op by op */
+	for (op = 0; op < NUM_STRESS_OPS; op++) {
+		struct samples s;
+		unsigned int errors = 0;
+
+		samples_init(&s, 1024);
+		for (i = 0; i < total; i++) {
+			unsigned int n;
+
+			for (n = 0; n < threads[i]->s[op].count; n++)
+				samples_add(&s, threads[i]->s[op].us[n]);
+			errors += threads[i]->errors[op];
+		}
+
+		if (s.count) {
+			report(stress_op_names[op], &s, 0, 0);
+			printf("%-20s %8u errors, %.1f ops/s\n", "", errors,
+			       s.count / elapsed);
+		}
+		free(s.us);
+	}
+
+	printf("%u threads, %.1f s, %.1f I2C transfers/s\n", total, elapsed,
+	       (after.i2c_xfers - before.i2c_xfers) / elapsed);
+	ret = 0;
+out:
+	for (i = 0; i < total; i++) {
+		struct stress_thread *t = threads[i];
+
+		if (!t)
+			continue;
+		close(t->fd);
+		for (op = 0; op < NUM_STRESS_OPS; op++)
+			free(t->s[op].us);
+		free(t);
+	}
+	free(threads);
+	return ret;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s -s SUBDEV [-v VIDEO] [-n N] [-D DIR] [-c CSV]\n"
+		"          [-t THREADS] [-d SECONDS] [test...]\n"
+		"\n"
+		"  -s SUBDEV  ar1335 subdev node, e.g. /dev/v4l-subdev0\n"
+		"  -v VIDEO   capture video node, needed by the stream test\n"
+		"  -n N       iterations per test (default 100)\n"
+		"  -D DIR     driver debugfs directory\n"
+		"             (default /sys/kernel/debug/ar1335-*)\n"
+		"  -c CSV     log every control write of the ctrl test to CSV\n"
+		"  -t N       stress test threads (default 4)\n"
+		"  -d S       stress test duration in seconds (default 10)\n"
+		"\n"
+		"Tests: fmt ctrl stream stress\n"
+		"       (default: fmt ctrl, plus stream with -v)\n",
+		argv0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *subdev = NULL, *video = NULL;
+	FILE *csv = NULL;
+	unsigned int iterations = 100;
+	unsigned int threads = 4, seconds = 10;
+	int sd_fd, video_fd = -1;
+	int opt, ret = 0;
+	int i;
+
+	while ((opt = getopt(argc, argv, "s:v:n:D:c:t:d:h")) != -1) {
+		switch (opt) {
+		case 's':
+			subdev = optarg;
+			break;
+		case 'v':
+			video = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'D':
+			debugfs_dir = optarg;
+			break;
+		case 't':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			csv = fopen(optarg, "w");
+			if (!csv) {
+				perror(optarg);
+				return 1;
+			}
+			fprintf(csv, "control,api,iteration,latency_us,i2c_xfers\n");
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!subdev || !iterations || !threads || !seconds) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!debugfs_dir)
+		debugfs_dir = find_debugfs_dir();
+	if (!debugfs_dir)
+		fprintf(stderr, "driver debugfs not found, driver columns are 0\n");
+
+	sd_fd = open(subdev, O_RDWR);
+	if (sd_fd < 0) {
+		perror(subdev);
+		return 1;
+	}
+
+	if (video) {
+		video_fd = open(video, O_RDWR);
+		if (video_fd < 0) {
+			perror(video);
+			close(sd_fd);
+			return 1;
+		}
+	}
+
+	print_header();
+
+	if (optind == argc) {
+		ret |= bench_fmt(sd_fd, iterations);
+		ret |= bench_ctrl(sd_fd, iterations, csv);
+		if (video_fd >= 0)
+			ret |= bench_stream(video_fd, iterations);
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (!strcmp(argv[i], "fmt")) {
+			ret |= bench_fmt(sd_fd, iterations);
+		} else if (!strcmp(argv[i], "ctrl")) {
+			ret |= bench_ctrl(sd_fd, iterations, csv);
+		} else if (!strcmp(argv[i], "stream")) {
+			if (video_fd < 0) {
+				fprintf(stderr, "stream test needs -v\n");
+				ret = 1;
+				continue;
+			}
+			ret |= bench_stream(video_fd, iterations);
+		} else if (!strcmp(argv[i], "stress")) {
+			ret |= bench_stress(subdev, video_fd, threads, seconds);
+		} else {
+			fprintf(stderr, "unknown test %s\n", argv[i]);
+			ret = 1;
+		}
+	}
+
+	if (video_fd >= 0)
+		close(video_fd);
+	close(sd_fd);
+	if (csv)
+		fclose(csv);
+
+	return ret ? 1 : 0;
+}